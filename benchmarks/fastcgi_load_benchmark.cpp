@@ -0,0 +1,386 @@
+/*
+ * Throughput and latency of the JSONCGIHandler without nginx. It
+ * starts a handler on a unix socket (or uses one which is already
+ * running) and sends requests over the fastCGI protocol from a
+ * number of client threads like nginx would.
+ *
+ * Usage: fastcgi_load_benchmark [options]
+ *   -c n      concurrent clients (default 16)
+ *   -d secs   duration (default 5)
+ *   -p pct    percentage of POST requests (default 0)
+ *   -g bytes  size of the GET response (default 1000)
+ *   -G ms     cache the GET response and change the data every ms
+ *             milliseconds, 0 for never (default: render every GET)
+ *   -b bytes  size of the POST data (default 100)
+ *   -w n      worker threads of the handler (default 4)
+ *   -n        native backend instead of libfcgi
+ *   -k        keep the connections open (fastcgi_keep_conn on)
+ *   -s path   use a handler which is already running on that socket
+ *   -h        print the options
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json_fastcgi_web_api.h"
+#include "json_writer.h"
+
+/**
+ * Renders an array of samples of about the requested size like
+ * the sensor demos do. With caching the handler only renders it
+ * again after the generation has been bumped.
+ **/
+class PayloadGETCallback : public JSONCGIHandler::GETCallback {
+public:
+	PayloadGETCallback(size_t bytes, bool argCached) : cached(argCached) {
+		// about 10 bytes per sample
+		for(size_t i = 0; i < bytes / 10; i++) {
+			samples.push_back((float)(sin(i * 0.1) * 5 + 20));
+		}
+	}
+	virtual std::string getJSONString() {
+		JSONWriter json;
+		json.beginObject();
+		json.key("data").array(samples);
+		json.endObject();
+		return json.str();
+	}
+	virtual JSONCGIHandler::Generation* getGeneration() {
+		return cached ? &generation : nullptr;
+	}
+	JSONCGIHandler::Generation generation;
+private:
+	const bool cached;
+	std::vector<float> samples;
+};
+
+/**
+ * Counts the POST data.
+ **/
+class CountingPOSTCallback : public JSONCGIHandler::POSTCallback {
+public:
+	virtual void postString(std::string postArg) {
+		received += postArg.length();
+	}
+	virtual void postString(const char* data, size_t length) {
+		(void)data;
+		received += length;
+	}
+	std::atomic<size_t> received{0};
+};
+
+/**
+ * Encodes the requests and decodes the responses of the
+ * fastCGI protocol on the web server side.
+ **/
+class FastCGIClient {
+public:
+	FastCGIClient(const std::string& argSocketPath, bool argKeepConn) :
+		socketPath(argSocketPath), keepConn(argKeepConn) {}
+
+	~FastCGIClient() {
+		disconnect();
+	}
+
+	/**
+	 * Sends one request and waits for the complete response.
+	 * \return false if the connection has failed
+	 **/
+	bool request(const std::string& method, const std::string& body, std::string& response) {
+		if ((fd < 0) && !connectSocket()) return false;
+		std::string out;
+		std::string begin(8, 0);
+		begin[1] = 1; // responder
+		begin[2] = keepConn ? 1 : 0;
+		record(out, 1, begin);
+		std::string params;
+		param(params, "REQUEST_METHOD", method);
+		param(params, "DOCUMENT_URI", "/bench");
+		param(params, "SCRIPT_NAME", "/bench");
+		param(params, "QUERY_STRING", "");
+		param(params, "CONTENT_LENGTH", std::to_string(body.size()));
+		param(params, "SERVER_PROTOCOL", "HTTP/1.1");
+		record(out, 4, params);
+		record(out, 4, "");
+		for(size_t i = 0; i < body.size(); i += 65535) {
+			record(out, 5, body.substr(i, 65535));
+		}
+		record(out, 5, "");
+		if (!sendAll(out)) return false;
+		response.clear();
+		while (true) {
+			unsigned char h[8];
+			if (!readAll((char*)h, 8)) return false;
+			const size_t length = ((size_t)h[4] << 8) | h[5];
+			content.resize(length + h[6]);
+			if (!readAll(&content[0], content.size())) return false;
+			if (h[1] == 6) {
+				response.append(content, 0, length);
+			} else if (h[1] == 3) {
+				break;
+			}
+		}
+		if (!keepConn) disconnect();
+		return true;
+	}
+
+private:
+	bool connectSocket() {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+		if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+			disconnect();
+			return false;
+		}
+		return true;
+	}
+
+	void disconnect() {
+		if (fd >= 0) close(fd);
+		fd = -1;
+	}
+
+	static void record(std::string& out, int type, const std::string& data) {
+		const size_t padding = (8 - (data.size() % 8)) % 8;
+		out += (char)1;
+		out += (char)type;
+		out += (char)0;
+		out += (char)1; // request id
+		out += (char)(data.size() >> 8);
+		out += (char)(data.size() & 0xff);
+		out += (char)padding;
+		out += (char)0;
+		out += data;
+		out.append(padding, 0);
+	}
+
+	static void length(std::string& out, size_t n) {
+		if (n < 128) {
+			out += (char)n;
+			return;
+		}
+		out += (char)(0x80 | (n >> 24));
+		out += (char)((n >> 16) & 0xff);
+		out += (char)((n >> 8) & 0xff);
+		out += (char)(n & 0xff);
+	}
+
+	static void param(std::string& out, const std::string& name, const std::string& value) {
+		length(out, name.size());
+		length(out, value.size());
+		out += name;
+		out += value;
+	}
+
+	bool sendAll(const std::string& s) {
+		size_t sent = 0;
+		while (sent < s.size()) {
+			const ssize_t n = send(fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+			if (n <= 0) {
+				disconnect();
+				return false;
+			}
+			sent += n;
+		}
+		return true;
+	}
+
+	bool readAll(char* data, size_t length) {
+		size_t received = 0;
+		while (received < length) {
+			const ssize_t n = read(fd, data + received, length - received);
+			if (n <= 0) {
+				disconnect();
+				return false;
+			}
+			received += n;
+		}
+		return true;
+	}
+
+	const std::string socketPath;
+	const bool keepConn;
+	int fd = -1;
+	std::string content;
+};
+
+/**
+ * Results of one client thread.
+ **/
+struct ClientStats {
+	std::vector<double> latenciesUs;
+	long ok = 0;
+	// replies with a "Status:" line such as 503
+	long rejected = 0;
+	long failed = 0;
+};
+
+static void client(const std::string& socketPath, bool keepConn, int postPercent,
+		   size_t postBytes, const std::atomic<bool>& running, ClientStats& stats, unsigned seed) {
+	FastCGIClient fcgi(socketPath, keepConn);
+	const std::string body(postBytes, 'y');
+	const std::string empty;
+	std::string response;
+	// waits after a failure so that a server which is down doesn't spin the clients
+	std::chrono::milliseconds backoff(0);
+	while (running) {
+		seed = seed * 1103515245 + 12345;
+		const bool post = (int)((seed >> 16) % 100) < postPercent;
+		const auto start = std::chrono::steady_clock::now();
+		const bool ok = fcgi.request(post ? "POST" : "GET", post ? body : empty, response);
+		const auto end = std::chrono::steady_clock::now();
+		if (!ok) {
+			stats.failed++;
+			backoff = std::min(std::max(backoff * 2, std::chrono::milliseconds(1)),
+					   std::chrono::milliseconds(100));
+			std::this_thread::sleep_for(backoff);
+			continue;
+		}
+		backoff = std::chrono::milliseconds(0);
+		if (response.compare(0, 7, "Status:") == 0) {
+			stats.rejected++;
+		} else {
+			stats.ok++;
+		}
+		stats.latenciesUs.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+	}
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+	if (sorted.empty()) return 0;
+	const size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+	return sorted[i];
+}
+
+static void usage(FILE* f, const char* name) {
+	fprintf(f, "Usage: %s [options]\n"
+		"  -c n      concurrent clients (default 16)\n"
+		"  -d secs   duration (default 5)\n"
+		"  -p pct    percentage of POST requests (default 0)\n"
+		"  -g bytes  size of the GET response (default 1000)\n"
+		"  -G ms     cache the GET response and change the data every ms\n"
+		"            milliseconds, 0 for never (default: render every GET)\n"
+		"  -b bytes  size of the POST data (default 100)\n"
+		"  -w n      worker threads of the handler (default 4)\n"
+		"  -n        native backend instead of libfcgi\n"
+		"  -k        keep the connections open (fastcgi_keep_conn on)\n"
+		"  -s path   use a handler which is already running on that socket\n"
+		"  -h        print the options\n", name);
+}
+
+int main(int argc, char* argv[]) {
+	int concurrency = 16;
+	double duration = 5;
+	int postPercent = 0;
+	size_t getBytes = 1000;
+	size_t postBytes = 100;
+	int nWorkers = 4;
+	bool native = false;
+	bool keepConn = false;
+	int bumpMs = -1;
+	std::string socketPath;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:d:p:g:G:b:w:nks:h")) != -1) {
+		switch (opt) {
+		case 'c': concurrency = atoi(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'p': postPercent = atoi(optarg); break;
+		case 'g': getBytes = atol(optarg); break;
+		case 'G': bumpMs = atoi(optarg); break;
+		case 'b': postBytes = atol(optarg); break;
+		case 'w': nWorkers = atoi(optarg); break;
+		case 'n': native = true; break;
+		case 'k': keepConn = true; break;
+		case 's': socketPath = optarg; break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		default:
+			usage(stderr, argv[0]);
+			return 1;
+		}
+	}
+
+	PayloadGETCallback getCallback(getBytes, bumpMs >= 0);
+	CountingPOSTCallback postCallback;
+	JSONCGIHandler handler;
+	if (socketPath.empty()) {
+		socketPath = "/tmp/fastcgi_load_benchmark_" + std::to_string(getpid());
+		if (native) handler.setBackend(JSONCGIHandler::Backend::NATIVE);
+		handler.start(&getCallback, &postCallback, socketPath.c_str(), nWorkers);
+		printf("handler: %s backend, %d workers\n", native ? "native" : "libfcgi", nWorkers);
+	}
+	printf("clients = %d, duration = %.1fs, POST = %d%%, GET response = %zuB, POST data = %zuB, %s\n",
+	       concurrency, duration, postPercent, getBytes, postBytes,
+	       keepConn ? "keep-alive" : "new connection per request");
+	if (bumpMs > 0) {
+		printf("GET responses cached, data changes every %dms\n", bumpMs);
+	} else if (0 == bumpMs) {
+		printf("GET responses cached, data never changes\n");
+	} else {
+		printf("GET responses rendered for every request\n");
+	}
+
+	std::atomic<bool> running{true};
+	// the data source which invalidates the cached response
+	std::thread bumper;
+	if (bumpMs > 0) {
+		bumper = std::thread([&]() {
+			while (running) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(bumpMs));
+				getCallback.generation.bump();
+			}
+		});
+	}
+	std::vector<ClientStats> stats(concurrency);
+	std::vector<std::thread> clients;
+	const auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < concurrency; i++) {
+		clients.push_back(std::thread(client, socketPath, keepConn, postPercent, postBytes,
+					      std::cref(running), std::ref(stats[i]), (unsigned)i + 1));
+	}
+	std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+	running = false;
+	for(auto& t : clients) {
+		t.join();
+	}
+	if (bumper.joinable()) bumper.join();
+	const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	handler.stop();
+	unlink(socketPath.c_str());
+
+	ClientStats total;
+	for(const auto& s : stats) {
+		total.ok += s.ok;
+		total.rejected += s.rejected;
+		total.failed += s.failed;
+		total.latenciesUs.insert(total.latenciesUs.end(), s.latenciesUs.begin(), s.latenciesUs.end());
+	}
+	std::sort(total.latenciesUs.begin(), total.latenciesUs.end());
+	printf("%12s %10s %10s %10s %10s %10s %10s\n",
+	       "requests/s", "ok", "rejected", "failed", "p50 us", "p99 us", "p999 us");
+	printf("%12.0f %10ld %10ld %10ld %10.1f %10.1f %10.1f\n",
+	       (total.ok + total.rejected) / secs, total.ok, total.rejected, total.failed,
+	       percentile(total.latenciesUs, 0.5),
+	       percentile(total.latenciesUs, 0.99),
+	       percentile(total.latenciesUs, 0.999));
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Serialisation time of a sample history with the JSONWriter
+ * compared to building a jsoncpp tree and Json::writeString()
+ * as the demos did previously.
+ *
+ * Usage: json_writer_benchmark [budget]
+ *
+ * budget: number of values serialised per array size (default 50e6)
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <jsoncpp/json/json.h>
+
+#include "json_writer.h"
+
+/**
+ * The previous path of the demos: a node per element and the
+ * default (indented) StreamWriterBuilder.
+ **/
+static std::string jsoncppPath(const std::vector<float>& values, const std::vector<long>& times) {
+	Json::Value root;
+	root["epoch"] = (Json::Int64)times.back();
+	root["lastvalue"] = values.back();
+	Json::Value temperature(Json::arrayValue);
+	for(size_t i = 0; i < values.size(); i++) {
+		temperature[(Json::ArrayIndex)i] = values[i];
+	}
+	root["temperature"] = temperature;
+	Json::Value t(Json::arrayValue);
+	for(size_t i = 0; i < times.size(); i++) {
+		t[(Json::ArrayIndex)i] = (Json::Int64)times[i];
+	}
+	root["time"] = t;
+	Json::StreamWriterBuilder builder;
+	return Json::writeString(builder, root);
+}
+
+static const std::string& writerPath(JSONWriter& json,
+				     const std::vector<float>& values,
+				     const std::vector<long>& times) {
+	json.clear();
+	json.beginObject();
+	json.key("epoch").value(times.back());
+	json.key("lastvalue").value(values.back());
+	json.key("temperature").array(values);
+	json.key("time").array(times);
+	json.endObject();
+	return json.str();
+}
+
+/**
+ * Runs f() repeatedly and returns the average time in ns.
+ **/
+template<typename F>
+static double timeIt(long repetitions, F f, size_t& bytes) {
+	const auto start = std::chrono::steady_clock::now();
+	for(long r = 0; r < repetitions; r++) {
+		bytes = f();
+	}
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / repetitions;
+}
+
+int main(int argc, char* argv[]) {
+	const double budget = (argc > 1) ? atof(argv[1]) : 50e6;
+	const size_t sizes[] = { 50, 500, 50000, 1000000 };
+	printf("%10s %16s %16s %16s %12s %12s\n",
+	       "samples", "jsoncpp ns", "writer ns", "writer 2dp ns", "jsoncpp B", "writer B");
+	for(const size_t n : sizes) {
+		std::vector<float> values(n);
+		std::vector<long> times(n);
+		for(size_t i = 0; i < n; i++) {
+			values[i] = (float)(sin(i * 0.1) * 5 + 20);
+			times[i] = 1700000000000L + (long)i * 100;
+		}
+		// about the same number of values processed for every size
+		const long repetitions = (long)(budget / n) + 1;
+		size_t jsoncppBytes = 0, writerBytes = 0, fixedBytes = 0;
+		const double jsoncppNs = timeIt(repetitions, [&]() {
+			return jsoncppPath(values, times).size();
+		}, jsoncppBytes);
+		JSONWriter json;
+		const double writerNs = timeIt(repetitions, [&]() {
+			return writerPath(json, values, times).size();
+		}, writerBytes);
+		json.setDecimals(2);
+		const double fixedNs = timeIt(repetitions, [&]() {
+			return writerPath(json, values, times).size();
+		}, fixedBytes);
+		printf("%10zu %16.0f %16.0f %16.0f %12zu %12zu\n",
+		       n, jsoncppNs, writerNs, fixedNs, jsoncppBytes, writerBytes);
+	}
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Throughput of the SampleRingBuffer and the TimeSeriesStore compared
+ * to a mutex protected std::deque as used previously by the demos.
+ *
+ * One producer pushes samples as fast as it can while reader
+ * threads keep taking snapshots of the most recent samples.
+ * It fails if any snapshot wasn't consecutive.
+ *
+ * Usage: ringbuffer_benchmark [capacity] [readers] [samples]
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sample_ringbuffer.h"
+#include "timeseries_store.h"
+
+/**
+ * The baseline: two deques as in the demos but with a mutex.
+ **/
+class LockedDeque {
+public:
+	LockedDeque(size_t capacity) : cap(capacity) {}
+
+	void push(int64_t t, float v) {
+		std::lock_guard<std::mutex> lock(mutex);
+		timeBuffer.push_back(t);
+		valueBuffer.push_back(v);
+		if (timeBuffer.size() > cap) {
+			timeBuffer.pop_front();
+			valueBuffer.pop_front();
+		}
+	}
+
+	std::vector<SampleRingBuffer<float>::Sample> snapshot() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<SampleRingBuffer<float>::Sample> samples(timeBuffer.size());
+		for(size_t i = 0; i < timeBuffer.size(); i++) {
+			samples[i].time = timeBuffer[i];
+			samples[i].value = valueBuffer[i];
+		}
+		return samples;
+	}
+
+private:
+	const size_t cap;
+	std::mutex mutex;
+	std::deque<int64_t> timeBuffer;
+	std::deque<float> valueBuffer;
+};
+
+/**
+ * The TimeSeriesStore as used by the demos. Snapshots are copied
+ * out of a slice and taken again if the writer has overwritten it.
+ **/
+class StoreSnapshots {
+public:
+	StoreSnapshots(size_t capacity) : store(capacity) {}
+
+	void push(int64_t t, float v) {
+		store.append(t, v);
+	}
+
+	std::vector<SampleRingBuffer<float>::Sample> snapshot() {
+		std::vector<SampleRingBuffer<float>::Sample> samples;
+		while (true) {
+			const TimeSeriesStore<float>::Slice slice = store.all();
+			samples.resize(slice.size());
+			for(size_t i = 0; i < slice.size(); i++) {
+				samples[i].time = slice.getTime()[i];
+				samples[i].value = slice.channel<0>()[i];
+			}
+			if (store.intact(slice)) return samples;
+		}
+	}
+
+private:
+	TimeSeriesStore<float> store;
+};
+
+/**
+ * Runs the producer and the readers and prints the rates.
+ * The readers also check that every snapshot is consecutive
+ * and that the values belong to their timestamps.
+ **/
+template<typename Buffer>
+long run(const char* name, Buffer& buffer, int nReaders, long nSamples) {
+	std::atomic<bool> producing{true};
+	std::atomic<long> snapshots{0};
+	std::atomic<long> broken{0};
+	std::vector<std::thread> readers;
+	for(int r = 0; r < nReaders; r++) {
+		readers.push_back(std::thread([&]() {
+			while (producing) {
+				const auto samples = buffer.snapshot();
+				for(size_t i = 0; i < samples.size(); i++) {
+					if ((samples[i].value != (float)(samples[i].time % 1000)) ||
+					    ((i > 0) && (samples[i].time != samples[i-1].time + 1))) {
+						broken++;
+						break;
+					}
+				}
+				snapshots++;
+			}
+		}));
+	}
+	const auto start = std::chrono::steady_clock::now();
+	for(long i = 0; i < nSamples; i++) {
+		buffer.push(i, (float)(i % 1000));
+	}
+	const auto end = std::chrono::steady_clock::now();
+	producing = false;
+	for(auto& t : readers) {
+		t.join();
+	}
+	const double secs = std::chrono::duration<double>(end - start).count();
+	printf("%-16s %12.0f pushes/s %12.0f snapshots/s %6ld broken snapshots\n",
+	       name, nSamples / secs, snapshots / secs, broken.load());
+	return broken;
+}
+
+int main(int argc, char* argv[]) {
+	const size_t capacity = (argc > 1) ? atol(argv[1]) : 500;
+	const int nReaders = (argc > 2) ? atoi(argv[2]) : 4;
+	const long nSamples = (argc > 3) ? atol(argv[3]) : 10000000;
+	printf("capacity = %zu, readers = %d, samples = %ld\n", capacity, nReaders, nSamples);
+	long broken = 0;
+	SampleRingBuffer<float> ringBuffer(capacity);
+	broken += run("SampleRingBuffer", ringBuffer, nReaders, nSamples);
+	StoreSnapshots store(capacity);
+	broken += run("TimeSeriesStore", store, nReaders, nSamples);
+	LockedDeque lockedDeque(capacity);
+	broken += run("mutex+deque", lockedDeque, nReaders, nSamples);
+	return (broken > 0) ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Time and heap allocations of a GET request of the fake sensor demo
+ * for different buffer sizes: JSONCGIADCCallback::getJSONString(),
+ * the assembly of the response header and the complete response
+ * with header and data as the handler sends it.
+ *
+ * Usage: serialization_benchmark [budget]
+ *   budget   number of samples serialised per buffer size (default 50e6)
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <new>
+#include <string>
+
+#include "fake_sensor_demo/demo_sensor_callbacks.h"
+
+// counted by the replaced global operator new
+static size_t allocations = 0;
+static size_t allocatedBytes = 0;
+
+void* operator new(size_t size) {
+	allocations++;
+	allocatedBytes += size;
+	void* p = malloc(size ? size : 1);
+	if (nullptr == p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
+
+/**
+ * Collects the response like the handler's response cache does.
+ **/
+class StringWriter : public JSONCGIHandler::ResponseWriter {
+public:
+	using ResponseWriter::write;
+	bool write(const char* data, size_t length) override {
+		buffer.append(data, length);
+		return true;
+	}
+	std::string buffer;
+};
+
+/**
+ * Cost of one request of a path.
+ **/
+struct Result {
+	double ns = 0;
+	double allocations = 0;
+	double bytes = 0;
+};
+
+/**
+ * Runs f() repeatedly after a warm-up call and returns the average
+ * time, number of allocations and allocated bytes per call.
+ **/
+template<typename F>
+static Result measure(long repetitions, F f, size_t& length) {
+	length = f();
+	const size_t allocations0 = allocations;
+	const size_t bytes0 = allocatedBytes;
+	const auto start = std::chrono::steady_clock::now();
+	for(long r = 0; r < repetitions; r++) {
+		length = f();
+	}
+	const auto end = std::chrono::steady_clock::now();
+	Result result;
+	result.ns = std::chrono::duration<double, std::nano>(end - start).count() / repetitions;
+	result.allocations = (double)(allocations - allocations0) / repetitions;
+	result.bytes = (double)(allocatedBytes - bytes0) / repetitions;
+	return result;
+}
+
+static void print(size_t samples, const char* path, size_t length, const Result& r) {
+	printf("%10zu %10s %12zu %12.0f %12.1f %12.0f\n",
+	       samples, path, length, r.ns, r.allocations, r.bytes);
+}
+
+int main(int argc, char* argv[]) {
+	const double budget = (argc > 1) ? atof(argv[1]) : 50e6;
+	const size_t sizes[] = { 50, 500, 5000, 50000 };
+	printf("%10s %10s %12s %12s %12s %12s\n",
+	       "samples", "path", "length B", "ns/request", "allocs/req", "bytes/req");
+	for(const size_t n : sizes) {
+		SENSORfastcgicallback sensor((int)n);
+		for(size_t i = 0; i < n; i++) {
+			sensor.hasSample((float)(sin(i * 0.1) * 5 + 20));
+		}
+		JSONCGIADCCallback callback(&sensor);
+		// about the same number of samples serialised for every size
+		const long repetitions = (long)(budget / n) + 1;
+		const JSONCGIHandler::Request request("/", "");
+		size_t length = 0;
+
+		const Result json = measure(repetitions, [&]() {
+			return callback.getJSONString().size();
+		}, length);
+		print(n, "json", length, json);
+
+		const Result header = measure(repetitions * 10, [&]() {
+			return JSONCGIHandler::getResponseHeader(&callback, callback.getETag()).size();
+		}, length);
+		print(n, "header", length, header);
+
+		// what the handler does for each uncached GET request
+		const Result response = measure(repetitions, [&]() {
+			StringWriter writer;
+			writer.write(JSONCGIHandler::getResponseHeader(&callback, callback.getETag()));
+			callback.writeJSONString(writer, request);
+			writer.write("\r\n", 2);
+			return writer.buffer.size();
+		}, length);
+		print(n, "response", length, response);
+	}
+	return 0;
+}
@@ -14,11 +14,15 @@
 
 #include "json_fastcgi_web_api.h"
 #include "ds18b20.h"
-#include <jsoncpp/json/json.h>
+#include "timeseries_store.h"
+#include "json_writer.h"
 
 // Constants
 const int temperatureBufferSize = 500;
 const int samplingIntervalSec = 10;
+#ifdef JSONCGI_TRACING
+const char traceFile[] = "/tmp/ds18b20_trace.json";
+#endif
 
 /**
  * Handler which receives the data here just saves
@@ -29,15 +33,15 @@ const int samplingIntervalSec = 10;
 class SENSORfastcgicallback : public SensorCallback
 {
 public:
-    std::deque<float> temperatureBuffer;
-    std::deque<long> timeBuffer;
-    long t;
-    int maxBufSize;
-    float lastValue = 0;
+    /**
+     * Timestamped readings. Written by the timer thread
+     * and read by the fastCGI thread.
+     **/
+    TimeSeriesStore<float> store;
+    JSONCGIHandler::Generation generation;
 
-    SENSORfastcgicallback(int maxReadingsInBuffer)
+    SENSORfastcgicallback(int maxReadingsInBuffer) : store(maxReadingsInBuffer)
     {
-        maxBufSize = maxReadingsInBuffer;
     }
 
     /**
@@ -49,15 +53,8 @@ public:
      **/
     virtual void hasTemperature(float v)
     {
-        lastValue = v;
-        temperatureBuffer.push_back(v);
-        if (temperatureBuffer.size() > maxBufSize)
-            temperatureBuffer.pop_front();
-        // timestamp
-        t = getTime();
-        timeBuffer.push_back(t);
-        if (timeBuffer.size() > maxBufSize)
-            timeBuffer.pop_front();
+        store.append(getTime(), v);
+        generation.bump();
     }
 
 private:
@@ -104,24 +101,44 @@ public:
      **/
     virtual std::string getJSONString()
     {
-        Json::Value root;
-        root["epoch"] = (long)time(NULL);
-        root["lastvalue"] = sensorfastcgi->lastValue;
-        Json::Value temperature;
-        for (int i = 0; i < sensorfastcgi->temperatureBuffer.size(); i++)
-        {
-            temperature[i] = sensorfastcgi->temperatureBuffer[i];
-        }
-        root["temperature"] = temperature;
-        Json::Value t;
-        for (int i = 0; i < sensorfastcgi->timeBuffer.size(); i++)
+        return getJSONString("");
+    }
+
+    /**
+     * With the query "since=<epoch_ms>" only the readings
+     * newer than the timestamp are sent.
+     **/
+    virtual std::string getJSONString(const std::string &queryString)
+    {
+        const std::string since = JSONCGIHandler::getQueryParameter(queryString, "since");
+        const long sinceTime = since.empty() ? -1 : atol(since.c_str());
+        // keeps its memory from one request to the next
+        static thread_local JSONWriter json;
+        TimeSeriesStore<float>::Slice all;
+        // read again if the timer thread has overwritten the readings meanwhile
+        do
         {
-            t[i] = sensorfastcgi->timeBuffer[i];
-        }
-        root["time"] = t;
-        Json::StreamWriterBuilder builder;
-        const std::string json_file = Json::writeString(builder, root);
-        return json_file;
+            all = sensorfastcgi->store.all();
+            // binary search for the first reading newer than "since"
+            const TimeSeriesStore<float>::Slice readings = all.since(sinceTime);
+            json.clear();
+            json.beginObject();
+            json.key("epoch").value((long)time(NULL));
+            json.key("lastvalue").value(all.empty() ? 0.0f : all.channel<0>().back());
+            json.key("temperature").array(readings.channel<0>());
+            json.key("time").array(readings.getTime());
+            json.endObject();
+        } while (!sensorfastcgi->store.intact(all));
+        return json.str();
+    }
+
+    /**
+     * The JSON is only rendered again when there is a new
+     * temperature reading.
+     **/
+    virtual JSONCGIHandler::Generation *getGeneration()
+    {
+        return &(sensorfastcgi->generation);
     }
 };
 
@@ -149,6 +166,11 @@ int main(int argc, char *argv[])
     // creating an instance of the fast CGI handler
     JSONCGIHandler jsoncgiHandler;
 
+#ifdef JSONCGI_TRACING
+    // the phases of the latest requests for chrome://tracing
+    jsoncgiHandler.setTracePath("/trace");
+#endif
+
     // starting the fastCGI handler with the callback and the
     // socket for nginx.
     jsoncgiHandler.start(&fastCGIADCCallback, nullptr,
@@ -166,6 +188,10 @@ int main(int argc, char *argv[])
     sigaddset(&mask, SIGINT);
     sigaddset(&mask, SIGQUIT);
     sigaddset(&mask, SIGHUP);
+#ifdef JSONCGI_TRACING
+    // kill -USR1 <PID> saves the trace
+    sigaddset(&mask, SIGUSR1);
+#endif
 
     /* Block signals so that they aren't handled
        according to their default dispositions. */
@@ -208,6 +234,19 @@ int main(int argc, char *argv[])
             printf("Got SIGHUP\n");
             running = false;
         }
+#ifdef JSONCGI_TRACING
+        else if (fdsi.ssi_signo == SIGUSR1)
+        {
+            if (JSONCGITrace::get().writeChromeJSON(traceFile))
+            {
+                printf("Trace saved to %s\n", traceFile);
+            }
+            else
+            {
+                fprintf(stderr, "Could not write %s\n", traceFile);
+            }
+        }
+#endif
         else
         {
             printf("Read unexpected signal\n");
@@ -5,16 +5,22 @@
  * GNU GENERAL PUBLIC LICENSE
  * Version 3, 29 June 2007
  *
- * (C) 2020-2024, Bernd Porr <mail@bernporr.me.uk>
- * 
+ * (C) 2020-2026, Bernd Porr <mail@bernporr.me.uk>
+ *
  * This is inspired by the timer_create man page.
  **/
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <time.h>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <algorithm>
 #include <sys/timerfd.h>
 
 /**
@@ -26,9 +32,98 @@ enum cppTimerType_t
     ONESHOT
 };
 
+class CppTimer;
+
 /**
- * Timer class which repeatedly fires. It's wrapper around the
- * POSIX per-process timer.
+ * Runs all CppTimers of the process with one thread and one timerfd
+ * instead of a thread and a timerfd per timer. The timers are kept in
+ * a hierarchical timer wheel with 1ms ticks so that starting and
+ * stopping one takes constant time however many there are. The timerfd
+ * is armed for the exact expiry of the next timer so that timers keep
+ * their ns resolution. By default timerEvent() is called from the
+ * timer thread. Every expiry results in a call, also when the thread
+ * wakes up late or is busy with other timers. A timer is never called
+ * again while its timerEvent() is still running: expiries which are
+ * missed meanwhile result in one call when it has returned.
+ **/
+class CppTimerService
+{
+
+public:
+    /**
+     * The service of the process. It's created when it's first used
+     * and never destroyed so that timers can be stopped at any time.
+     **/
+    static CppTimerService& get() {
+	static CppTimerService* service = new CppTimerService();
+	return *service;
+    }
+
+    /**
+     * Calls timerEvent() from a pool of threads instead of the
+     * timer thread so that a slow timer doesn't delay the others.
+     * Threads are only added, never removed.
+     * @param n Number of worker threads
+     **/
+    void setWorkers(unsigned n) {
+	std::lock_guard<std::mutex> lock(mutex);
+	while (workers.size() < n) {
+	    workers.push_back(std::thread(&CppTimerService::worker, this));
+	}
+    }
+
+private:
+    friend class CppTimer;
+
+    static const int levels = 4;
+    static const int slotBits = 6;
+    static const int slots = 1 << slotBits;
+    static const int64_t tickNs = 1000000;
+
+    CppTimerService() {
+	fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (fd < 0)
+	    throw("Could not start timer");
+	tick = now() / tickNs;
+    }
+
+    static int64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    inline void add(CppTimer* t, long nanosecs, bool periodic);
+    inline void remove(CppTimer* t);
+    inline void insert(CppTimer* t);
+    inline void unlink(CppTimer* t);
+    inline void advance(int64_t nowNs);
+    inline int64_t nextExpiry() const;
+    inline void arm(int64_t expiry);
+    inline void run();
+    inline void worker();
+    inline bool dispatch(std::unique_lock<std::mutex>& lock);
+
+    std::mutex mutex;
+    // timers have become ready or have returned from timerEvent()
+    std::condition_variable changed;
+    int fd = -1;
+    // the tick which is being processed
+    int64_t tick = 0;
+    // time the timerfd is armed for
+    int64_t armed = INT64_MAX;
+    CppTimer* wheel[levels][slots] = {};
+    // bit i is set if slot i of the level has timers
+    uint64_t occupied[levels] = {};
+    // timers which are due, in the order of their expiry
+    std::deque<CppTimer*> ready;
+    std::thread thread;
+    std::vector<std::thread> workers;
+};
+
+/**
+ * Timer class which repeatedly fires. All timers are run
+ * by the CppTimerService.
  **/
 class CppTimer
 {
@@ -44,30 +139,7 @@ public:
      * @param type Either PERIODIC or ONESHOT
      **/
     virtual void startns(long nanosecs, cppTimerType_t type = PERIODIC) {
-	if (running) return;
-	fd = timerfd_create(CLOCK_MONOTONIC, 0);
-	if (fd < 0)
-	    throw("Could not start timer");
-	switch (type)
-	{
-	case (PERIODIC):
-	    //starts after specified period of nanoseconds
-	    its.it_value.tv_sec = nanosecs / 1000000000;
-	    its.it_value.tv_nsec = nanosecs % 1000000000;
-	    its.it_interval.tv_sec = nanosecs / 1000000000;
-	    its.it_interval.tv_nsec = nanosecs % 1000000000;
-	    break;
-	case (ONESHOT):
-	    //fires once after specified period of nanoseconds
-	    its.it_value.tv_sec = nanosecs / 1000000000;
-	    its.it_value.tv_nsec = nanosecs % 1000000000;
-	    its.it_interval.tv_sec = 0;
-	    its.it_interval.tv_nsec = 0;
-	    break;
-	}
-	if (timerfd_settime(fd, 0, &its, NULL) == -1)
-	    throw("Could not start timer");
-	uthread = std::thread(&CppTimer::worker,this);
+	CppTimerService::get().add(this, nanosecs, PERIODIC == type);
     }
 
     /**
@@ -80,45 +152,20 @@ public:
      * @param type Either PERIODIC or ONESHOT
      **/
     virtual void startms(long millisecs, cppTimerType_t type = PERIODIC) {
-	if (running) return;
-	fd = timerfd_create(CLOCK_MONOTONIC, 0);
-	if (fd < 0)
-	    throw("Could not start timer");
-	switch (type)
-	{
-	case (PERIODIC):
-	    //starts after specified period of milliseconds
-	    its.it_value.tv_sec = millisecs / 1000;
-	    its.it_value.tv_nsec = (millisecs % 1000) * 1000000;
-	    its.it_interval.tv_sec = millisecs / 1000;
-	    its.it_interval.tv_nsec = (millisecs % 1000) * 1000000;
-	    break;
-	case (ONESHOT):
-	    //fires once after specified period of milliseconds
-	    its.it_value.tv_sec = millisecs / 1000;
-	    its.it_value.tv_nsec = (millisecs % 1000) * 1000000;
-	    its.it_interval.tv_sec = 0;
-	    its.it_interval.tv_nsec = 0;
-	    break;
-	}
-	if (timerfd_settime(fd, 0, &its, NULL) == -1)
-	    throw("Could not start timer");
-	uthread = std::thread(&CppTimer::worker,this);
+	CppTimerService::get().add(this, millisecs * 1000000, PERIODIC == type);
     }
 
     /**
-     * Stops the timer by disarming it. It can be re-started
-     * with start().
+     * Stops the timer and waits until a running timerEvent()
+     * has returned unless it's called from there. It can be
+     * re-started with start().
      **/
     virtual void stop() {
-	if (!running) return;
-	running = false;
-	uthread.join();
+	CppTimerService::get().remove(this);
     }
 
     /**
-     * Destructor disarms the timer, deletes it and
-     * disconnect the signal handler.
+     * Destructor stops the timer.
      **/
     virtual ~CppTimer() {
 	stop();
@@ -132,31 +179,235 @@ protected:
     virtual void timerEvent() = 0;
 
 private:
-    int fd = 0;
-    struct itimerspec its;
+    friend class CppTimerService;
+    // all guarded by the mutex of the service
     bool running = false;
-    std::thread uthread;
-    void worker() {
-	running = true;
-	while (running) {
-	    uint64_t exp;
-	    const long int s = read(fd, &exp, sizeof(uint64_t));
-	    if (s != sizeof(uint64_t) ) {
-		running = false;
-		return;
+    int64_t expiry = 0;
+    int64_t interval = 0;
+    // position in the wheel, level -1 if it's not in there
+    int level = -1;
+    int slot = 0;
+    CppTimer* prev = nullptr;
+    CppTimer* next = nullptr;
+    // in the ready queue
+    bool queued = false;
+    // calls of timerEvent() which are due
+    int64_t pending = 0;
+    // expired while in timerEvent()
+    bool coalesced = false;
+    // in timerEvent()
+    bool firing = false;
+    std::thread::id firingThread;
+};
+
+void CppTimerService::add(CppTimer* t, long nanosecs, bool periodic) {
+    if (nanosecs <= 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (t->running) return;
+    if (!thread.joinable()) {
+	thread = std::thread(&CppTimerService::run, this);
+    }
+    if ((0 == (occupied[0] | occupied[1] | occupied[2] | occupied[3])) && ready.empty()) {
+	// nothing depends on the current tick when the wheel is empty
+	tick = std::max(tick, now() / tickNs);
+    }
+    t->running = true;
+    t->interval = periodic ? nanosecs : 0;
+    t->expiry = now() + nanosecs;
+    insert(t);
+    if (t->expiry < armed) arm(t->expiry);
+}
+
+void CppTimerService::remove(CppTimer* t) {
+    std::unique_lock<std::mutex> lock(mutex);
+    t->running = false;
+    if (t->level >= 0) unlink(t);
+    if (t->queued) {
+	ready.erase(std::find(ready.begin(), ready.end(), t));
+	t->queued = false;
+    }
+    t->pending = 0;
+    t->coalesced = false;
+    changed.wait(lock, [t]() {
+	return !t->firing || (t->firingThread == std::this_thread::get_id());
+    });
+}
+
+/**
+ * Puts a timer into the slot of its expiry. The further away it
+ * is the coarser the level. Timers are moved down a level when
+ * the slot of a coarser level has been reached.
+ **/
+void CppTimerService::insert(CppTimer* t) {
+    int64_t expiryTick = std::max(t->expiry / tickNs, tick);
+    const int64_t maxDelta = ((int64_t)1 << (slotBits * levels)) - 1;
+    // beyond the wheel it's put into the last slot and moved on from there
+    expiryTick = std::min(expiryTick, tick + maxDelta);
+    const int64_t delta = expiryTick - tick;
+    int l = 0;
+    while ((l < levels - 1) && (delta >= ((int64_t)1 << (slotBits * (l + 1))))) l++;
+    const int s = (int)(expiryTick >> (slotBits * l)) & (slots - 1);
+    t->level = l;
+    t->slot = s;
+    t->prev = nullptr;
+    t->next = wheel[l][s];
+    if (nullptr != t->next) t->next->prev = t;
+    wheel[l][s] = t;
+    occupied[l] |= (uint64_t)1 << s;
+}
+
+void CppTimerService::unlink(CppTimer* t) {
+    if (nullptr != t->prev) {
+	t->prev->next = t->next;
+    } else {
+	wheel[t->level][t->slot] = t->next;
+	if (nullptr == t->next) occupied[t->level] &= ~((uint64_t)1 << t->slot);
+    }
+    if (nullptr != t->next) t->next->prev = t->prev;
+    t->level = -1;
+    t->prev = nullptr;
+    t->next = nullptr;
+}
+
+/**
+ * Moves the timers which are due into the ready queue
+ * and processes the ticks up to the current one.
+ **/
+void CppTimerService::advance(int64_t nowNs) {
+    const int64_t nowTick = nowNs / tickNs;
+    while (true) {
+	CppTimer* t = wheel[0][tick & (slots - 1)];
+	while (nullptr != t) {
+	    CppTimer* n = t->next;
+	    if (t->expiry <= nowNs) {
+		unlink(t);
+		int64_t expiries = 1;
+		if (t->interval > 0) {
+		    // stays in step with the interval like a timerfd
+		    expiries = (nowNs - t->expiry) / t->interval + 1;
+		    t->expiry += expiries * t->interval;
+		    insert(t);
+		} else {
+		    t->running = false;
+		}
+		if (!t->firing) {
+		    t->pending += expiries;
+		} else if (!t->coalesced) {
+		    t->coalesced = true;
+		    t->pending++;
+		}
+		if (!t->queued) {
+		    t->queued = true;
+		    ready.push_back(t);
+		}
+	    }
+	    t = n;
+	}
+	if (tick >= nowTick) break;
+	tick++;
+	// moves the timers of the coarser slots which have been reached down
+	for(int l = 1; l < levels; l++) {
+	    if ((tick & (((int64_t)1 << (slotBits * l)) - 1)) != 0) break;
+	    const int s = (int)(tick >> (slotBits * l)) & (slots - 1);
+	    CppTimer* c = wheel[l][s];
+	    wheel[l][s] = nullptr;
+	    occupied[l] &= ~((uint64_t)1 << s);
+	    while (nullptr != c) {
+		CppTimer* n = c->next;
+		insert(c);
+		c = n;
 	    }
-	    timerEvent();
 	}
-	// disarm
-	struct itimerspec itsnew;
-	itsnew.it_value.tv_sec = 0;
-	itsnew.it_value.tv_nsec = 0;
-	itsnew.it_interval.tv_sec = 0;
-	itsnew.it_interval.tv_nsec = 0;
-	timerfd_settime(fd, 0, &itsnew, &its);
-	close(fd);
-	fd = -1;
     }
-};
+    if (!ready.empty()) changed.notify_all();
+}
+
+/**
+ * @return The time when the next timer expires or when
+ *         timers need to be moved down a level
+ **/
+int64_t CppTimerService::nextExpiry() const {
+    int64_t expiry = INT64_MAX;
+    // the first occupied slot of the finest level has the next timers
+    const int current = (int)(tick & (slots - 1));
+    const uint64_t fine = (occupied[0] >> current) | (current ? (occupied[0] << (slots - current)) : 0);
+    if (0 != fine) {
+	for(const CppTimer* t = wheel[0][(current + __builtin_ctzll(fine)) & (slots - 1)];
+	    nullptr != t; t = t->next) {
+	    expiry = std::min(expiry, t->expiry);
+	}
+    }
+    for(int l = 1; l < levels; l++) {
+	const int64_t window = tick >> (slotBits * l);
+	// the current slot of a coarser level is only reached again after a full turn
+	const int from = (int)((window + 1) & (slots - 1));
+	const uint64_t coarse = (occupied[l] >> from) | (from ? (occupied[l] << (slots - from)) : 0);
+	if (0 == coarse) continue;
+	const int64_t reached = (window + 1 + __builtin_ctzll(coarse)) << (slotBits * l);
+	expiry = std::min(expiry, reached * tickNs);
+    }
+    return expiry;
+}
+
+void CppTimerService::arm(int64_t expiry) {
+    armed = expiry;
+    struct itimerspec its = {};
+    if (INT64_MAX != expiry) {
+	its.it_value.tv_sec = expiry / 1000000000;
+	its.it_value.tv_nsec = expiry % 1000000000;
+    }
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void CppTimerService::run() {
+    while (true) {
+	uint64_t exp;
+	const long int s = read(fd, &exp, sizeof(uint64_t));
+	std::unique_lock<std::mutex> lock(mutex);
+	if (s == sizeof(uint64_t)) {
+	    advance(now());
+	    arm(nextExpiry());
+	}
+	if (workers.empty()) {
+	    while (dispatch(lock));
+	}
+    }
+}
+
+void CppTimerService::worker() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+	if (!dispatch(lock)) changed.wait(lock);
+    }
+}
+
+/**
+ * Calls timerEvent() of the first ready timer which
+ * isn't running already. A timer with more than one
+ * pending call is queued again at the end.
+ * @return false if there was none
+ **/
+bool CppTimerService::dispatch(std::unique_lock<std::mutex>& lock) {
+    const auto it = std::find_if(ready.begin(), ready.end(),
+				 [](const CppTimer* t) { return !t->firing; });
+    if (it == ready.end()) return false;
+    CppTimer* t = *it;
+    ready.erase(it);
+    // one call at a time so that the other timers get their turn
+    if (--t->pending > 0) {
+	ready.push_back(t);
+    } else {
+	t->queued = false;
+    }
+    t->coalesced = false;
+    t->firing = true;
+    t->firingThread = std::this_thread::get_id();
+    lock.unlock();
+    t->timerEvent();
+    lock.lock();
+    t->firing = false;
+    changed.notify_all();
+    return true;
+}
 
 #endif
@@ -0,0 +1,161 @@
+#ifndef __DEMO_SENSOR_CALLBACKS_H
+#define __DEMO_SENSOR_CALLBACKS_H
+
+/*
+ * Copyright (c) 2013-2023  Bernd Porr <mail@berndporr.me.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ *
+ */
+
+#include <time.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "json_fastcgi_web_api.h"
+#include "fakesensor.h"
+#include "timeseries_store.h"
+#include "json_writer.h"
+
+/**
+ * Handler which receives the data here just saves
+ * the most recent sample with timestamp. Obviously,
+ * in a real application the data would be stored
+ * in a database and/or triggers events and other things!
+ **/
+class SENSORfastcgicallback : public SensorCallback {
+public:
+	/**
+	 * Timestamped samples. Written by the timer thread
+	 * and read by the fastCGI thread.
+	 **/
+	TimeSeriesStore<float> store;
+	JSONCGIHandler::Generation generation;
+
+	SENSORfastcgicallback(int maxBufSize = 50) : store(maxBufSize) {}
+
+	/**
+	 * Callback with the fresh ADC data.
+	 * That's where all the internal processing
+	 * of the data is happening. Here, we just
+	 * convert the raw ADC data to temperature
+	 * and store it in a variable.
+	 **/
+	virtual void hasSample(float v) {
+		if (forcedSteps > 0) {
+			forcedSteps--;
+			v = forcedTemperature;
+		}
+		store.append(getTimeMS(), v);
+		generation.bump();
+	}
+
+	/**
+	 * Forces the next samples to a fixed temperature. It's called
+	 * from the fastCGI thread and only the timer thread writes
+	 * to the buffer, so the samples are forced in hasSample().
+	 * \param temp Temperature
+	 * \param steps Number of samples to be forced
+	 **/
+	void forceTemperature(float temp, int steps) {
+		forcedTemperature = temp;
+		forcedSteps = steps;
+	}
+
+private:
+	std::atomic<float> forcedTemperature{0};
+	std::atomic<int> forcedSteps{0};
+
+	static unsigned long getTimeMS() {
+                std::chrono::time_point<std::chrono::system_clock> now = 
+                        std::chrono::system_clock::now();
+                auto duration = now.time_since_epoch();
+                return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+        }
+};
+
+
+/**
+ * Callback handler which returns data to the
+ * nginx server. Here, simply the current temperature
+ * and the timestamp is transmitted to nginx and the
+ * javascript application.
+ **/
+class JSONCGIADCCallback : public JSONCGIHandler::GETCallback {
+private:
+	/**
+	 * Pointer to the ADC event handler because it keeps
+	 * the data in this case. In a proper application
+	 * that would be probably a database class or a
+	 * controller keeping it all together.
+	 **/
+	SENSORfastcgicallback* sensorfastcgi;
+
+public:
+	/**
+	 * Constructor: argument is the ADC callback handler
+	 * which keeps the data as a simple example.
+	 **/
+	JSONCGIADCCallback(SENSORfastcgicallback* argSENSORfastcgi) {
+		sensorfastcgi = argSENSORfastcgi;
+	}
+
+	/**
+	 * Gets the data sends it to the webserver.
+	 * The callback creates two json entries. One with the
+	 * timestamp and one with the temperature from the sensor.
+	 **/
+	virtual std::string getJSONString() {
+		return getJSONString("");
+	}
+
+	/**
+	 * With the query "since=<epoch_ms>" only the samples
+	 * newer than the timestamp are sent.
+	 **/
+	virtual std::string getJSONString(const std::string& queryString) {
+	const std::string since = JSONCGIHandler::getQueryParameter(queryString, "since");
+	const long sinceTime = since.empty() ? -1 : atol(since.c_str());
+	// keeps its memory from one request to the next
+	static thread_local JSONWriter json;
+	TimeSeriesStore<float>::Slice all;
+	// read again if the timer thread has overwritten the samples meanwhile
+	do {
+		all = sensorfastcgi->store.all();
+		// binary search for the first sample newer than "since"
+		const TimeSeriesStore<float>::Slice slice = all.since(sinceTime);
+		json.clear();
+		json.beginObject();
+		json.key("epoch").value((long)time(NULL));
+		json.key("lastvalue").value(all.empty() ? 0.0f : all.channel<0>().back());
+		json.key("temperature").array(slice.channel<0>());
+		json.key("time").array(slice.getTime());
+		json.endObject();
+	} while (!sensorfastcgi->store.intact(all));
+	return json.str();
+	}
+
+	/**
+	 * Browsers with an EventSource get pushed only the
+	 * most recent sample.
+	 **/
+	virtual std::string getEventString() {
+		const TimeSeriesStore<float>::Slice latest = sensorfastcgi->store.latest(1);
+		if (latest.empty()) return getJSONString();
+		return getJSONString("since=" + std::to_string(latest.getTime().back() - 1));
+	}
+
+	/**
+	 * The JSON is only rendered again when there is a new sample.
+	 **/
+	virtual JSONCGIHandler::Generation* getGeneration() {
+		return &(sensorfastcgi->generation);
+	}
+};
+
+
+#endif
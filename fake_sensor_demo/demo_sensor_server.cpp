@@ -11,8 +11,9 @@
 #include <unistd.h>
 
 #include "json_fastcgi_web_api.h"
-#include "fakesensor.h"
-#include <jsoncpp/json/json.h>
+#include "demo_sensor_callbacks.h"
+#include "json_sax_parser.h"
+#include "json_batch_post.h"
 
 /**
  * Flag to indicate that we are running.
@@ -52,130 +53,66 @@ void setHUPHandler() {
 
 
 /**
- * Handler which receives the data here just saves
- * the most recent sample with timestamp. Obviously,
- * in a real application the data would be stored
- * in a database and/or triggers events and other things!
+ * Callback handler which receives the JSON from jQuery.
+ * It can be one command or an array of them.
  **/
-class SENSORfastcgicallback : public SensorCallback {
+class SENSORPOSTCallback : public BatchPOSTCallback {
 public:
-	std::deque<float> temperatureBuffer;
-	std::deque<long> timeBuffer;
-	long t;
-	const int maxBufSize = 50;
-	float lastValue = 0;
-
-	/**
-	 * Callback with the fresh ADC data.
-	 * That's where all the internal processing
-	 * of the data is happening. Here, we just
-	 * convert the raw ADC data to temperature
-	 * and store it in a variable.
-	 **/
-	virtual void hasSample(float v) {
-		lastValue = v;
-		temperatureBuffer.push_back(v);
-		if (temperatureBuffer.size() > maxBufSize) temperatureBuffer.pop_front();
-		// timestamp
-		t = getTimeMS();
-		timeBuffer.push_back(t);
-		if (timeBuffer.size() > maxBufSize) timeBuffer.pop_front();
-	}
-
-	void forceTemperature(float temp) {
-		for(auto& v:temperatureBuffer) {
-			v = temp;
-		}
-	}
-
-private:
-	static unsigned long getTimeMS() {
-                std::chrono::time_point<std::chrono::system_clock> now = 
-                        std::chrono::system_clock::now();
-                auto duration = now.time_since_epoch();
-                return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
-        }
-};
-
-
-/**
- * Callback handler which returns data to the
- * nginx server. Here, simply the current temperature
- * and the timestamp is transmitted to nginx and the
- * javascript application.
- **/
-class JSONCGIADCCallback : public JSONCGIHandler::GETCallback {
-private:
-	/**
-	 * Pointer to the ADC event handler because it keeps
-	 * the data in this case. In a proper application
-	 * that would be probably a database class or a
-	 * controller keeping it all together.
-	 **/
-	SENSORfastcgicallback* sensorfastcgi;
-
-public:
-	/**
-	 * Constructor: argument is the ADC callback handler
-	 * which keeps the data as a simple example.
-	 **/
-	JSONCGIADCCallback(SENSORfastcgicallback* argSENSORfastcgi) {
+	SENSORPOSTCallback(SENSORfastcgicallback* argSENSORfastcgi) {
 		sensorfastcgi = argSENSORfastcgi;
 	}
 
 	/**
-	 * Gets the data sends it to the webserver.
-	 * The callback creates two json entries. One with the
-	 * timestamp and one with the temperature from the sensor.
+	 * Picks the values out of the JSON object
+	 * {"temperature":20,"steps":10,"hello":"..."}.
 	 **/
-	virtual std::string getJSONString() {
-        Json::Value root;
-        root["epoch"] = (long)time(NULL);
-	root["lastvalue"] = sensorfastcgi->lastValue;
-        Json::Value temperature;
-        for(int i = 0; i < sensorfastcgi->temperatureBuffer.size(); i++) {
-        	temperature[i] = sensorfastcgi->temperatureBuffer[i];
-    	}
-        root["temperature"]  = temperature;
-		Json::Value t;
-        for(int i = 0; i < sensorfastcgi->timeBuffer.size(); i++) {
-			t[i] = sensorfastcgi->timeBuffer[i];
-    	}
-		root["time"] = t;
-        Json::StreamWriterBuilder builder;
-    	const std::string json_file = Json::writeString(builder, root);
-        return json_file;
-	}
-};
+	class ForceCommand : public JSONSAXParser::Handler {
+	public:
+		virtual void startObject() { depth++; }
+		virtual void endObject() { depth--; }
+		virtual void startArray() { depth++; }
+		virtual void endArray() { depth--; }
+
+		virtual void key(const char* s, size_t length) {
+			currentKey.assign(s, length);
+		}
+
+		virtual void number(double v) {
+			if (depth != 1) return;
+			if (currentKey == "temperature") temp = (float)v;
+			if (currentKey == "steps") steps = (int)v;
+		}
 
+		virtual void string(const char* s, size_t length) {
+			if ((depth == 1) && (currentKey == "hello")) {
+				std::cerr << std::string(s, length) << "\n";
+			}
+		}
 
-/**
- * Callback handler which receives the JSON from jQuery
- **/
-class SENSORPOSTCallback : public JSONCGIHandler::POSTCallback {
-public:
-	SENSORPOSTCallback(SENSORfastcgicallback* argSENSORfastcgi) {
-		sensorfastcgi = argSENSORfastcgi;
-	}
+		float temp = 0;
+		int steps = 0;
+	private:
+		std::string currentKey;
+		int depth = 0;
+	};
 
 	/**
 	 * As a crude example we force the temperature readings
 	 * to be 20 degrees for a certain number of timesteps.
 	 **/
-	virtual void postString(std::string postArg) {
-		const auto rawJsonLength = static_cast<int>(postArg.length());
-		JSONCPP_STRING err;
-		Json::Value root;
-		Json::CharReaderBuilder builder;
-		const std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
-		if (!reader->parse(postArg.c_str(), postArg.c_str() + rawJsonLength, &root,
-				   &err)) {
-			std::cout << "error" << std::endl;
-			return;
+	virtual Result postCommand(const char* data, size_t length) {
+		ForceCommand command;
+		JSONSAXParser parser(command);
+		Result result;
+		if (!(parser.feed(data, length) && parser.finish())) {
+			result.status = 400;
+			result.error = parser.getError();
+			return result;
 		}
-		float temp = root["temperature"].asFloat();
-		std::cerr << root["hello"].asString() << "\n";
-		sensorfastcgi->forceTemperature(temp);
+		if (command.steps < 1) command.steps = (int)(sensorfastcgi->store.capacity());
+		sensorfastcgi->forceTemperature(command.temp, command.steps);
+		result.json = "{\"steps\":" + std::to_string(command.steps) + "}";
+		return result;
 	}
 
 	/**
@@ -0,0 +1,932 @@
+#ifndef FASTCGI_NATIVE_H
+#define FASTCGI_NATIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+
+#include "json_fastcgi_trace.h"
+
+/**
+ * One request of a fastCGI server and its response.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+class FastCGIExchange {
+public:
+	virtual ~FastCGIExchange() = default;
+	/**
+	 * \return The fastCGI parameters as "NAME=value" strings
+	 *         terminated by a nullptr
+	 **/
+	virtual char** getEnvp() = 0;
+	/**
+	 * Reads the POST data. Blocks until some has arrived.
+	 * \param data Buffer for the data
+	 * \param length Max number of bytes
+	 * \return Number of bytes read or 0 at the end of the data
+	 **/
+	virtual int read(char* data, size_t length) = 0;
+	/**
+	 * Sends a piece of the response. It might be buffered.
+	 * \return false if the web server has closed the connection
+	 **/
+	virtual bool write(const char* data, size_t length) = 0;
+	/**
+	 * Sends what has been buffered.
+	 * \return false if the web server has closed the connection
+	 **/
+	virtual bool flush() = 0;
+	/**
+	 * Completes the response.
+	 **/
+	virtual void finish() = 0;
+	/**
+	 * \return The time when the request was ready to be processed.
+	 *         Requests waiting in the listen backlog count as just arrived.
+	 **/
+	virtual std::chrono::steady_clock::time_point getArrivalTime() {
+		return std::chrono::steady_clock::now();
+	}
+};
+
+/**
+ * FastCGI server which speaks the record protocol itself instead
+ * of using libfcgi. One thread runs an epoll event loop for the
+ * listening socket and all connections. It parses the record
+ * headers straight out of a linear receive buffer per connection
+ * and hands every request over to the worker threads once its
+ * parameters are complete. The POST data follows while the request
+ * is processed. The contents of the PARAMS and STDIN records are
+ * copied once, into the request and its input queue, because the
+ * receive buffer is reused for the next records.
+ *
+ * Connections are kept open for further requests if nginx asks
+ * for it with "fastcgi_keep_conn on" and requests on the same
+ * connection can be processed at the same time (multiplexed).
+ *
+ * Workers send their responses without blocking the event loop:
+ * they write as much as the socket takes and the event loop sends
+ * the rest. A worker only waits if a lot of its output is queued.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+class FastCGINativeServer {
+public:
+	FastCGINativeServer() = default;
+	FastCGINativeServer(const FastCGINativeServer&) = delete;
+	FastCGINativeServer& operator=(const FastCGINativeServer&) = delete;
+
+	/**
+	 * Opens the socket and starts the event loop.
+	 * \param socketpath Path of a unix socket or ":port" or
+	 *        "host:port" for a TCP socket
+	 **/
+	void start(const char* socketpath) {
+		if (running) return;
+		listenFd = openSocket(socketpath);
+		if (listenFd < 0) {
+			throw "Could not open socket.";
+		}
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+		wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		addToEpoll(listenFd, &listenFd);
+		addToEpoll(wakeFd, &wakeFd);
+		running = true;
+		accepting = true;
+		thread = std::thread(&FastCGINativeServer::run, this);
+	}
+
+	/**
+	 * Waits for the next request.
+	 * \return The request or nullptr if the server has been stopped
+	 **/
+	std::unique_ptr<FastCGIExchange> next() {
+		JSONCGI_TRACE("accept");
+		std::unique_lock<std::mutex> lock(queueMutex);
+		queueChanged.wait(lock, [this]() { return !queue.empty() || !accepting; });
+		if (!accepting) return nullptr;
+		std::unique_ptr<FastCGIExchange> exchange = std::move(queue.front());
+		queue.pop_front();
+		return exchange;
+	}
+
+	/**
+	 * \return Number of requests waiting for a worker
+	 **/
+	size_t getQueueLength() {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		return queue.size();
+	}
+
+	/**
+	 * Closes the listening socket and makes next() return nullptr.
+	 * The open connections are still served so that requests which
+	 * are being processed can finish their responses. POST data
+	 * which hasn't fully arrived yet is aborted.
+	 **/
+	void stopAccepting() {
+		if (!accepting) return;
+		accepting = false;
+		// the event loop closes the listening socket
+		wake();
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queueChanged.notify_all();
+	}
+
+	/**
+	 * Stops the event loop and closes all connections. Requests
+	 * which are still being processed can no longer send anything.
+	 **/
+	void stop() {
+		if (!running) return;
+		stopAccepting();
+		running = false;
+		wake();
+		thread.join();
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			queue.clear();
+		}
+		if (listenFd >= 0) close(listenFd);
+		listenFd = -1;
+	}
+
+	~FastCGINativeServer() {
+		stop();
+		// workers might still use them until they have finished
+		if (wakeFd >= 0) close(wakeFd);
+		if (epollFd >= 0) close(epollFd);
+	}
+
+private:
+	// record types
+	static const uint8_t BEGIN_REQUEST = 1;
+	static const uint8_t ABORT_REQUEST = 2;
+	static const uint8_t END_REQUEST = 3;
+	static const uint8_t PARAMS = 4;
+	static const uint8_t STDIN = 5;
+	static const uint8_t STDOUT = 6;
+	static const uint8_t GET_VALUES = 9;
+	static const uint8_t GET_VALUES_RESULT = 10;
+	static const uint8_t UNKNOWN_TYPE = 11;
+	static const uint16_t RESPONDER = 1;
+	static const uint8_t KEEP_CONN = 1;
+	static const uint8_t REQUEST_COMPLETE = 0;
+	static const uint8_t UNKNOWN_ROLE = 3;
+
+	static const size_t headerLength = 8;
+	// the largest record with content and padding
+	static const size_t maxRecordLength = headerLength + 65535 + 255;
+	// content of the STDOUT records, a multiple of 8 so that there's no padding
+	static const size_t stdoutRecordContent = 32768;
+	// reading stops while a request has that much POST data queued
+	static const size_t maxQueuedInput = 1024 * 1024;
+	// workers wait while that much of the output is queued
+	static const size_t maxQueuedOutput = 1024 * 1024;
+
+	/**
+	 * POST data of one request which has arrived
+	 * but hasn't been read by the worker yet.
+	 **/
+	struct Input {
+		std::mutex mutex;
+		std::condition_variable arrived;
+		std::deque<std::string> chunks;
+		// read position in the first chunk
+		size_t offset = 0;
+		size_t queued = 0;
+		bool eof = false;
+		bool aborted = false;
+		// the exchange has gone and doesn't need any more data
+		bool detached = false;
+		// reading from the connection has stopped because of it
+		bool paused = false;
+	};
+
+	class Exchange;
+
+	/**
+	 * A connection from the web server which can carry
+	 * several requests one after the other or at the same time.
+	 **/
+	struct Connection {
+		int fd = -1;
+		// only used by the event loop
+		std::vector<char> in;
+		size_t inStart = 0;
+		size_t inEnd = 0;
+		struct Pending {
+			// until the parameters are complete
+			std::unique_ptr<Exchange> exchange;
+			// until the POST data is complete
+			std::shared_ptr<Input> input;
+		};
+		std::unordered_map<uint16_t, Pending> requests;
+		// shared with the workers
+		std::mutex mutex;
+		std::condition_variable drained;
+		std::string out;
+		size_t outPos = 0;
+		bool closed = false;
+		bool wantWrite = false;
+		bool inputPaused = false;
+		// the web server hasn't asked to keep the connection
+		bool closeWhenDrained = false;
+	};
+
+	/**
+	 * A request on a connection. The response is collected in
+	 * STDOUT records which are sent when they are full.
+	 **/
+	class Exchange : public FastCGIExchange {
+	public:
+		Exchange(FastCGINativeServer* argServer,
+			 const std::shared_ptr<Connection>& argConnection,
+			 const std::shared_ptr<Input>& argInput,
+			 uint16_t argId, bool argKeepConn) :
+			server(argServer), connection(argConnection), input(argInput),
+			id(argId), keepConn(argKeepConn) {
+			// room for the record header
+			out.resize(headerLength);
+		}
+
+		~Exchange() {
+			finish();
+			bool resume = false;
+			{
+				std::lock_guard<std::mutex> lock(input->mutex);
+				input->detached = true;
+				input->chunks.clear();
+				input->queued = 0;
+				resume = input->paused;
+				input->paused = false;
+			}
+			if (resume) server->resume(connection);
+		}
+
+		char** getEnvp() override { return envp.data(); }
+
+		std::chrono::steady_clock::time_point getArrivalTime() override { return arrival; }
+
+		int read(char* data, size_t length) override {
+			JSONCGI_TRACE("read");
+			std::unique_lock<std::mutex> lock(input->mutex);
+			input->arrived.wait(lock, [this]() {
+				return !input->chunks.empty() || input->eof || input->aborted;
+			});
+			size_t n = 0;
+			while ((n < length) && !input->chunks.empty()) {
+				const std::string& chunk = input->chunks.front();
+				const size_t k = std::min(length - n, chunk.size() - input->offset);
+				memcpy(data + n, chunk.data() + input->offset, k);
+				n += k;
+				input->offset += k;
+				if (input->offset == chunk.size()) {
+					input->chunks.pop_front();
+					input->offset = 0;
+				}
+			}
+			input->queued -= n;
+			const bool resume = input->paused && (input->queued < maxQueuedInput / 2);
+			if (resume) input->paused = false;
+			lock.unlock();
+			if (resume) server->resume(connection);
+			return (int)n;
+		}
+
+		bool write(const char* data, size_t length) override {
+			JSONCGI_TRACE("write");
+			while (length > 0) {
+				const size_t n = std::min(length, stdoutRecordContent + headerLength - out.size());
+				out.append(data, n);
+				data += n;
+				length -= n;
+				if (out.size() == stdoutRecordContent + headerLength) {
+					if (!flush()) return false;
+				}
+			}
+			return !failed;
+		}
+
+		bool flush() override {
+			JSONCGI_TRACE("flush");
+			if (input->aborted) failed = true;
+			if (failed || (out.size() == headerLength)) {
+				out.resize(headerLength);
+				return !failed;
+			}
+			const size_t padding = writeHeader(&out[0], STDOUT, id, out.size() - headerLength);
+			out.append(padding, 0);
+			if (!server->send(*connection, out.data(), out.size(), true)) failed = true;
+			out.resize(headerLength);
+			return !failed;
+		}
+
+		void finish() override {
+			if (finished) return;
+			JSONCGI_TRACE("finish");
+			finished = true;
+			flush();
+			// the empty STDOUT record ends the stream
+			char end[3 * headerLength] = {};
+			writeHeader(end, STDOUT, id, 0);
+			writeHeader(end + headerLength, END_REQUEST, id, headerLength);
+			end[2 * headerLength + 4] = REQUEST_COMPLETE;
+			server->send(*connection, end, sizeof(end), true);
+			if (!keepConn) server->closeWhenDrained(*connection);
+		}
+
+		/**
+		 * Ends a request which has been aborted before it was
+		 * started. It has no output so it's ended without waiting
+		 * for the output of other requests on the connection to
+		 * drain because that's done by the event loop calling it.
+		 **/
+		void drop() {
+			finished = true;
+			server->endRequest(*connection, id, REQUEST_COMPLETE);
+			if (!keepConn) server->closeWhenDrained(*connection);
+		}
+
+		/**
+		 * Turns the name-value pairs of the PARAMS records
+		 * into "NAME=value" strings.
+		 **/
+		void parseParams() {
+			env.clear();
+			std::vector<size_t> offsets;
+			size_t pos = 0;
+			size_t nameLength = 0, valueLength = 0;
+			while (readLength(params, pos, nameLength) &&
+			       readLength(params, pos, valueLength) &&
+			       (pos + nameLength + valueLength <= params.size())) {
+				offsets.push_back(env.size());
+				env.append(params, pos, nameLength);
+				env += '=';
+				env.append(params, pos + nameLength, valueLength);
+				env += '\0';
+				pos += nameLength + valueLength;
+			}
+			envp.clear();
+			for(const size_t o : offsets) {
+				envp.push_back(&env[o]);
+			}
+			envp.push_back(nullptr);
+			arrival = std::chrono::steady_clock::now();
+		}
+
+		// content of the PARAMS records
+		std::string params;
+
+	private:
+		FastCGINativeServer* server;
+		std::shared_ptr<Connection> connection;
+		std::shared_ptr<Input> input;
+		const uint16_t id;
+		const bool keepConn;
+		std::string env;
+		std::vector<char*> envp;
+		std::chrono::steady_clock::time_point arrival;
+		// STDOUT record which is being filled
+		std::string out;
+		bool failed = false;
+		bool finished = false;
+	};
+
+	/**
+	 * Writes a record header.
+	 * \return Number of padding bytes which need to follow the content
+	 **/
+	static size_t writeHeader(char* h, uint8_t type, uint16_t id, size_t length) {
+		const size_t padding = (8 - (length % 8)) % 8;
+		h[0] = 1;
+		h[1] = (char)type;
+		h[2] = (char)(id >> 8);
+		h[3] = (char)(id & 0xff);
+		h[4] = (char)(length >> 8);
+		h[5] = (char)(length & 0xff);
+		h[6] = (char)padding;
+		h[7] = 0;
+		return padding;
+	}
+
+	/**
+	 * Reads the length of a name or value: one byte below
+	 * 128 and otherwise four bytes with the top bit set.
+	 **/
+	static bool readLength(const std::string& s, size_t& pos, size_t& length) {
+		if (pos >= s.size()) return false;
+		const unsigned char* p = (const unsigned char*)s.data() + pos;
+		if (p[0] < 128) {
+			length = p[0];
+			pos++;
+			return true;
+		}
+		if (pos + 4 > s.size()) return false;
+		length = ((size_t)(p[0] & 0x7f) << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | p[3];
+		pos += 4;
+		return true;
+	}
+
+	static void appendLength(std::string& s, size_t length) {
+		if (length < 128) {
+			s += (char)length;
+			return;
+		}
+		s += (char)(0x80 | (length >> 24));
+		s += (char)((length >> 16) & 0xff);
+		s += (char)((length >> 8) & 0xff);
+		s += (char)(length & 0xff);
+	}
+
+	/**
+	 * Opens a unix socket or, if there's a ':' in the
+	 * path, a TCP socket like FCGX_OpenSocket().
+	 **/
+	static int openSocket(const char* socketpath) {
+		const char* colon = strchr(socketpath, ':');
+		int fd = -1;
+		if (nullptr == colon) {
+			struct sockaddr_un addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			if (strlen(socketpath) >= sizeof(addr.sun_path)) return -1;
+			strcpy(addr.sun_path, socketpath);
+			unlink(socketpath);
+			fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if (fd < 0) return -1;
+			if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+				close(fd);
+				return -1;
+			}
+		} else {
+			const std::string host(socketpath, colon - socketpath);
+			struct addrinfo hints;
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_INET;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = AI_PASSIVE;
+			struct addrinfo* result = nullptr;
+			if (getaddrinfo(host.empty() ? nullptr : host.c_str(), colon + 1, &hints, &result) != 0) {
+				return -1;
+			}
+			fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			const int one = 1;
+			if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if ((fd >= 0) && (bind(fd, result->ai_addr, result->ai_addrlen) < 0)) {
+				close(fd);
+				fd = -1;
+			}
+			freeaddrinfo(result);
+			if (fd < 0) return -1;
+		}
+		if (listen(fd, 1024) < 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	void addToEpoll(int fd, void* ptr) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = ptr;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+	}
+
+	/**
+	 * Sets the events the event loop waits for.
+	 * The mutex of the connection needs to be locked.
+	 **/
+	void updateEvents(Connection& c) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLRDHUP;
+		if (!c.inputPaused) ev.events |= EPOLLIN;
+		if (c.wantWrite) ev.events |= EPOLLOUT;
+		ev.data.ptr = &c;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, c.fd, &ev);
+	}
+
+	void wake() {
+		const uint64_t one = 1;
+		if (::write(wakeFd, &one, sizeof(one)) < 0) {
+			// the counter is already set
+		}
+	}
+
+	/**
+	 * Sends the data or queues what the socket doesn't take
+	 * straight away for the event loop.
+	 * \param wait Waits while too much output is queued
+	 * \return false if the connection has been closed
+	 **/
+	bool send(Connection& c, const char* data, size_t length, bool wait) {
+		std::unique_lock<std::mutex> lock(c.mutex);
+		if (wait) {
+			c.drained.wait(lock, [&c]() {
+				return c.closed || (c.out.size() - c.outPos < maxQueuedOutput);
+			});
+		}
+		if (c.closed) return false;
+		if (c.outPos == c.out.size()) {
+			c.out.clear();
+			c.outPos = 0;
+			const ssize_t n = ::send(c.fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (n < 0) {
+				if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+					// the event loop closes it
+					shutdown(c.fd, SHUT_RDWR);
+					return false;
+				}
+			} else {
+				data += n;
+				length -= n;
+			}
+		}
+		if (length > 0) {
+			c.out.append(data, length);
+			if (!c.wantWrite) {
+				c.wantWrite = true;
+				updateEvents(c);
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Closes the connection once everything has been sent.
+	 **/
+	void closeWhenDrained(Connection& c) {
+		std::lock_guard<std::mutex> lock(c.mutex);
+		if (c.closed) return;
+		c.closeWhenDrained = true;
+		if (c.outPos == c.out.size()) {
+			// the event loop sees the hangup and closes it
+			shutdown(c.fd, SHUT_RDWR);
+		}
+	}
+
+	/**
+	 * Asks the event loop to read from the connection again.
+	 **/
+	void resume(const std::shared_ptr<Connection>& c) {
+		if (!running) return;
+		{
+			std::lock_guard<std::mutex> lock(resumeMutex);
+			resumeList.push_back(c);
+		}
+		wake();
+	}
+
+	void run() {
+		struct epoll_event events[64];
+		while (running) {
+			const int n = epoll_wait(epollFd, events, 64, -1);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			for(int i = 0; i < n; i++) {
+				void* ptr = events[i].data.ptr;
+				if (ptr == &listenFd) {
+					acceptConnections();
+				} else if (ptr == &wakeFd) {
+					uint64_t count;
+					if (::read(wakeFd, &count, sizeof(count)) < 0) {
+						// nothing to do
+					}
+					if (!accepting && (listenFd >= 0)) {
+						closeListener();
+					}
+					resumeConnections();
+				} else {
+					Connection* c = (Connection*)ptr;
+					// it might have been closed by an earlier event
+					if (connections.find(c) == connections.end()) continue;
+					if (events[i].events & EPOLLERR) {
+						closeConnection(c);
+						continue;
+					}
+					if (events[i].events & EPOLLOUT) {
+						writable(*c);
+					}
+					if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) {
+						readable(c);
+					}
+				}
+			}
+			closed.clear();
+		}
+		while (!connections.empty()) {
+			closeConnection(connections.begin()->first);
+		}
+		closed.clear();
+	}
+
+	void acceptConnections() {
+		while (accepting) {
+			const int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) return;
+			std::shared_ptr<Connection> c = std::make_shared<Connection>();
+			c->fd = fd;
+			c->in.resize(maxRecordLength);
+			connections[c.get()] = c;
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN | EPOLLRDHUP;
+			ev.data.ptr = c.get();
+			epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+		}
+	}
+
+	/**
+	 * Closes the listening socket and aborts the POST data which
+	 * is still arriving so that no worker keeps waiting for it.
+	 **/
+	void closeListener() {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, listenFd, nullptr);
+		close(listenFd);
+		listenFd = -1;
+		for(auto& c : connections) {
+			for(auto& r : c.second->requests) {
+				if (r.second.input) abort(*(r.second.input));
+			}
+		}
+	}
+
+	void resumeConnections() {
+		std::vector<std::shared_ptr<Connection>> list;
+		{
+			std::lock_guard<std::mutex> lock(resumeMutex);
+			list.swap(resumeList);
+		}
+		for(auto& c : list) {
+			std::lock_guard<std::mutex> lock(c->mutex);
+			if (c->closed || !c->inputPaused) continue;
+			c->inputPaused = false;
+			updateEvents(*c);
+		}
+	}
+
+	void closeConnection(Connection* c) {
+		const auto it = connections.find(c);
+		if (it == connections.end()) return;
+		{
+			std::lock_guard<std::mutex> lock(c->mutex);
+			c->closed = true;
+			close(c->fd);
+		}
+		c->drained.notify_all();
+		for(auto& r : c->requests) {
+			abort(*(r.second.input));
+		}
+		// the pending exchanges are deleted here
+		c->requests.clear();
+		// the connection itself at the end of the loop
+		// because there might be more events for it
+		closed.push_back(it->second);
+		connections.erase(it);
+	}
+
+	static void abort(Input& input) {
+		{
+			std::lock_guard<std::mutex> lock(input.mutex);
+			input.aborted = true;
+		}
+		input.arrived.notify_all();
+	}
+
+	void writable(Connection& c) {
+		std::lock_guard<std::mutex> lock(c.mutex);
+		if (c.closed) return;
+		while (c.outPos < c.out.size()) {
+			const ssize_t n = ::send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos,
+						 MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (n < 0) {
+				if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+					shutdown(c.fd, SHUT_RDWR);
+				}
+				break;
+			}
+			c.outPos += n;
+		}
+		if (c.outPos == c.out.size()) {
+			c.out.clear();
+			c.outPos = 0;
+			c.wantWrite = false;
+			updateEvents(c);
+			if (c.closeWhenDrained) shutdown(c.fd, SHUT_RDWR);
+		}
+		c.drained.notify_all();
+	}
+
+	void readable(Connection* c) {
+		// the unparsed rest of the buffer is moved to the
+		// start so that a whole record always fits
+		if (c->inStart > 0) {
+			memmove(c->in.data(), c->in.data() + c->inStart, c->inEnd - c->inStart);
+			c->inEnd -= c->inStart;
+			c->inStart = 0;
+		}
+		const ssize_t n = ::read(c->fd, c->in.data() + c->inEnd, c->in.size() - c->inEnd);
+		if (n == 0) {
+			closeConnection(c);
+			return;
+		}
+		if (n < 0) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+				closeConnection(c);
+			}
+			return;
+		}
+		c->inEnd += n;
+		parseRecords(c);
+	}
+
+	/**
+	 * Processes all complete records in the receive buffer.
+	 **/
+	void parseRecords(Connection* c) {
+		while (c->inEnd - c->inStart >= headerLength) {
+			const unsigned char* h = (const unsigned char*)c->in.data() + c->inStart;
+			if (h[0] != 1) {
+				// not fastCGI version 1
+				closeConnection(c);
+				return;
+			}
+			const uint8_t type = h[1];
+			const uint16_t id = (uint16_t)((h[2] << 8) | h[3]);
+			const size_t contentLength = ((size_t)h[4] << 8) | h[5];
+			const size_t recordLength = headerLength + contentLength + h[6];
+			if (c->inEnd - c->inStart < recordLength) return;
+			const char* content = (const char*)h + headerLength;
+			c->inStart += recordLength;
+			record(c, type, id, content, contentLength);
+			if (connections.find(c) == connections.end()) return;
+		}
+	}
+
+	void record(Connection* c, uint8_t type, uint16_t id, const char* content, size_t length) {
+		const std::shared_ptr<Connection>& connection = connections[c];
+		if ((type == GET_VALUES) && (0 == id)) {
+			getValues(*c, content, length);
+			return;
+		}
+		if (type == BEGIN_REQUEST) {
+			if (length < 8) return;
+			const uint16_t role = (uint16_t)(((unsigned char)content[0] << 8) | (unsigned char)content[1]);
+			if (role != RESPONDER) {
+				endRequest(*c, id, UNKNOWN_ROLE);
+				return;
+			}
+			const bool keepConn = (content[2] & KEEP_CONN) != 0;
+			Connection::Pending& p = c->requests[id];
+			p.input = std::make_shared<Input>();
+			p.exchange.reset(new Exchange(this, connection, p.input, id, keepConn));
+			return;
+		}
+		const auto it = c->requests.find(id);
+		if (it == c->requests.end()) {
+			if (0 == id) unknownType(*c, type);
+			return;
+		}
+		Connection::Pending& p = it->second;
+		switch (type) {
+		case PARAMS:
+			if (!p.exchange) return;
+			if (length > 0) {
+				p.exchange->params.append(content, length);
+				return;
+			}
+			// all parameters have arrived
+			p.exchange->parseParams();
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				queue.push_back(std::move(p.exchange));
+			}
+			queueChanged.notify_one();
+			return;
+		case STDIN:
+			if (0 == length) {
+				std::lock_guard<std::mutex> lock(p.input->mutex);
+				p.input->eof = true;
+				p.input->arrived.notify_all();
+			} else {
+				std::lock_guard<std::mutex> lock(p.input->mutex);
+				if (p.input->detached) return;
+				p.input->chunks.emplace_back(content, length);
+				p.input->queued += length;
+				p.input->arrived.notify_all();
+				if ((p.input->queued > maxQueuedInput) && !p.input->paused) {
+					// stops reading until the worker has caught up
+					p.input->paused = true;
+					std::lock_guard<std::mutex> connectionLock(c->mutex);
+					c->inputPaused = true;
+					updateEvents(*c);
+				}
+				return;
+			}
+			if (!p.exchange) c->requests.erase(it);
+			return;
+		case ABORT_REQUEST:
+			abort(*(p.input));
+			if (p.exchange) {
+				// hasn't been started yet
+				p.exchange->drop();
+				p.exchange.reset();
+			}
+			c->requests.erase(it);
+			return;
+		default:
+			return;
+		}
+	}
+
+	void endRequest(Connection& c, uint16_t id, uint8_t protocolStatus) {
+		char end[2 * headerLength] = {};
+		writeHeader(end, END_REQUEST, id, headerLength);
+		end[headerLength + 4] = (char)protocolStatus;
+		send(c, end, sizeof(end), false);
+	}
+
+	void unknownType(Connection& c, uint8_t type) {
+		char record[2 * headerLength] = {};
+		writeHeader(record, UNKNOWN_TYPE, 0, headerLength);
+		record[headerLength] = (char)type;
+		send(c, record, sizeof(record), false);
+	}
+
+	/**
+	 * Tells the web server that connections can be multiplexed.
+	 **/
+	void getValues(Connection& c, const char* content, size_t length) {
+		const std::string query(content, length);
+		std::string values;
+		size_t pos = 0;
+		size_t nameLength = 0, valueLength = 0;
+		while (readLength(query, pos, nameLength) &&
+		       readLength(query, pos, valueLength) &&
+		       (pos + nameLength + valueLength <= query.size())) {
+			const std::string name = query.substr(pos, nameLength);
+			pos += nameLength + valueLength;
+			std::string value;
+			if (name == "FCGI_MAX_CONNS") value = "1024";
+			else if (name == "FCGI_MAX_REQS") value = "1024";
+			else if (name == "FCGI_MPXS_CONNS") value = "1";
+			else continue;
+			appendLength(values, name.size());
+			appendLength(values, value.size());
+			values += name;
+			values += value;
+		}
+		std::string record(headerLength, 0);
+		const size_t padding = writeHeader(&record[0], GET_VALUES_RESULT, 0, values.size());
+		record += values;
+		record.append(padding, 0);
+		send(c, record.data(), record.size(), false);
+	}
+
+	std::atomic<bool> running{false};
+	std::atomic<bool> accepting{false};
+	// only used by the event loop once it's running
+	int listenFd = -1;
+	int epollFd = -1;
+	int wakeFd = -1;
+	std::thread thread;
+	// only used by the event loop
+	std::unordered_map<Connection*, std::shared_ptr<Connection>> connections;
+	std::vector<std::shared_ptr<Connection>> closed;
+	// requests waiting for a worker
+	std::mutex queueMutex;
+	std::condition_variable queueChanged;
+	std::deque<std::unique_ptr<FastCGIExchange>> queue;
+	// connections which can be read from again
+	std::mutex resumeMutex;
+	std::vector<std::shared_ptr<Connection>> resumeList;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef JSON_BATCH_POST_H
+#define JSON_BATCH_POST_H
+
+#include <stddef.h>
+#include <string>
+#include <memory>
+
+#include "json_writer.h"
+#include "json_fastcgi_web_api.h"
+
+/**
+ * POST callback which receives many commands in one request,
+ * either as a JSON array or as newline delimited JSON (one value
+ * per line):
+ *
+ *     [{"temperature":20,"steps":10},{"temperature":25,"steps":5}]
+ *
+ * Every command is passed on to postCommand() as soon as it has
+ * arrived and the reply is a JSON array with one status object per
+ * command in the same order:
+ *
+ *     [{"status":200},{"status":400,"error":"Missing steps."}]
+ *
+ * A single JSON object is a batch with one command. A body which
+ * starts with "[" is an array of commands unless it's sent with the
+ * content type application/x-ndjson, so that newline delimited
+ * commands can be arrays as well. Empty elements of the array such
+ * as in "[{...},,{...}]" or "[{...},]" get the status 400. Data
+ * after the closing "]" is ignored and gets one entry with the
+ * status 400 at the end.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+class BatchPOSTCallback : public JSONCGIHandler::StreamingPOSTCallback {
+public:
+	/**
+	 * Outcome of one command.
+	 **/
+	struct Result {
+		/**
+		 * HTTP style status code of the command.
+		 **/
+		int status = 200;
+		/**
+		 * JSON value returned to the client as "result" or
+		 * an empty string for none.
+		 **/
+		std::string json;
+		/**
+		 * Error message returned to the client as "error" or
+		 * an empty string for none.
+		 **/
+		std::string error;
+	};
+
+	/**
+	 * Needs to execute one command. With several workers it's called
+	 * concurrently for different requests and needs to be thread safe.
+	 * \param json Pointer to the JSON text of the command. It's zero
+	 *        terminated and only valid during the call.
+	 * \param length Length of the JSON text
+	 * \return Status and optional result of the command
+	 **/
+	virtual Result postCommand(const char* json, size_t length) = 0;
+
+	/**
+	 * Sets the max size of one command. Longer ones are skipped
+	 * and get the status 413.
+	 * \param bytes Max number of bytes (default 64kB)
+	 **/
+	void setMaxCommandSize(size_t bytes) {
+		maxCommandSize = bytes;
+	}
+
+	std::unique_ptr<Receiver> postBegin(size_t contentLength) override {
+		(void)contentLength;
+		return std::unique_ptr<Receiver>(new BatchReceiver(this, false));
+	}
+
+	std::unique_ptr<Receiver> postBegin(const JSONCGIHandler::Request& request,
+					    size_t contentLength) override {
+		(void)contentLength;
+		// application/x-ndjson or application/ndjson
+		const bool lines = request.getParam("CONTENT_TYPE").find("ndjson") != std::string_view::npos;
+		return std::unique_ptr<Receiver>(new BatchReceiver(this, lines));
+	}
+
+private:
+	/**
+	 * Splits the POST data into commands while it arrives. Only
+	 * strings and the nesting are tracked to find the end of a
+	 * command. Parsing it is left to postCommand().
+	 **/
+	class BatchReceiver : public Receiver {
+	public:
+		/**
+		 * \param argCallback Receives the commands
+		 * \param lines true if the commands are newline delimited
+		 *        even if the first one is an array
+		 **/
+		BatchReceiver(BatchPOSTCallback* argCallback, bool lines) :
+			callback(argCallback), started(lines) {
+			json.beginArray();
+		}
+
+		bool postChunk(const char* data, size_t length) override {
+			for(size_t i = 0; i < length; i++) {
+				split(data[i]);
+			}
+			return true;
+		}
+
+		bool postEnd() override {
+			if (isArray && !arrayClosed) {
+				// the array has been cut off
+				error(400, "Incomplete JSON.");
+			} else if (!isArray) {
+				endCommand(false);
+			}
+			json.endArray();
+			return true;
+		}
+
+		std::string getContentType() override { return "application/json"; }
+
+		std::string getResponseString() override { return json.str(); }
+
+	private:
+		static bool isSpace(char c) {
+			return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+		}
+
+		/**
+		 * Processes the next character of the POST data.
+		 **/
+		void split(char c) {
+			if (arrayClosed) {
+				// the commands have already been executed
+				if (!isSpace(c) && !trailingData) {
+					trailingData = true;
+					error(400, "Data after the array.");
+				}
+				return;
+			}
+			if (!started) {
+				if (isSpace(c)) return;
+				started = true;
+				if (c == '[') {
+					isArray = true;
+					return;
+				}
+			}
+			if (inString) {
+				if (escape) {
+					escape = false;
+				} else if (c == '\\') {
+					escape = true;
+				} else if (c == '"') {
+					inString = false;
+				}
+				append(c);
+				return;
+			}
+			if (depth == 0) {
+				if (isArray && ((c == ',') || (c == ']'))) {
+					arrayClosed = (c == ']');
+					// only "[]" has no commands
+					endCommand(!arrayClosed || (nCommands > 0));
+					return;
+				}
+				if (!isArray && (c == '\n')) {
+					// empty lines are skipped
+					endCommand(false);
+					return;
+				}
+				// whitespace between the commands
+				if (command.empty() && isSpace(c)) return;
+			}
+			if (c == '"') {
+				inString = true;
+			} else if ((c == '{') || (c == '[')) {
+				depth++;
+			} else if (((c == '}') || (c == ']')) && (depth > 0)) {
+				depth--;
+			}
+			append(c);
+		}
+
+		void append(char c) {
+			if (command.size() >= callback->maxCommandSize) {
+				tooLong = true;
+				return;
+			}
+			command += c;
+		}
+
+		/**
+		 * Passes on the command which has been received.
+		 * \param required true if an empty command is an error
+		 **/
+		void endCommand(bool required) {
+			if (tooLong) {
+				error(413, "Command too long.");
+			} else {
+				while (!command.empty() && isSpace(command.back())) command.pop_back();
+				if (command.empty()) {
+					if (required) error(400, "Missing command.");
+					return;
+				}
+				const Result result = callback->postCommand(command.c_str(), command.length());
+				nCommands++;
+				json.beginObject();
+				json.key("status").value(result.status);
+				if (!result.json.empty()) {
+					json.key("result").raw(result.json.data(), result.json.length());
+				}
+				if (!result.error.empty()) {
+					json.key("error").value(result.error);
+				}
+				json.endObject();
+			}
+			command.clear();
+			tooLong = false;
+			depth = 0;
+		}
+
+		void error(int status, const char* message) {
+			nCommands++;
+			json.beginObject();
+			json.key("status").value(status);
+			json.key("error").value(message);
+			json.endObject();
+		}
+
+		BatchPOSTCallback* callback;
+		JSONWriter json;
+		// the command which is being received
+		std::string command;
+		bool started = false;
+		bool isArray = false;
+		bool arrayClosed = false;
+		bool trailingData = false;
+		bool inString = false;
+		bool escape = false;
+		bool tooLong = false;
+		int depth = 0;
+		// commands answered so far
+		size_t nCommands = 0;
+	};
+
+	size_t maxCommandSize = 65536;
+};
+
+#endif
@@ -0,0 +1,531 @@
+#ifndef JSON_FASTCGI_COROUTINE_H
+#define JSON_FASTCGI_COROUTINE_H
+
+#if __cplusplus < 202002L
+#error "json_fastcgi_coroutine.h needs C++20."
+#endif
+
+#include <stdint.h>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <chrono>
+#include <queue>
+#include <deque>
+#include <vector>
+#include <unordered_set>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+
+#include "json_fastcgi_web_api.h"
+
+/**
+ * Runs coroutines on one thread. A coroutine which waits for
+ * a timer, new data or another event doesn't occupy a thread
+ * but only its frame so thousands of requests can be pending:
+ *
+ *     JSONCGIScheduler scheduler;
+ *     scheduler.start();
+ *     ...
+ *     JSONCGITask<std::string> getJSONCoroutine(JSONCGICoroRequest request) override {
+ *         co_await JSONCGIScheduler::sleepFor(std::chrono::milliseconds(100));
+ *         co_await JSONCGIScheduler::nextChange(generation, seen);
+ *         co_return json;
+ *     }
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+class JSONCGIScheduler {
+	struct Core;
+public:
+	JSONCGIScheduler() = default;
+	JSONCGIScheduler(const JSONCGIScheduler&) = delete;
+	JSONCGIScheduler& operator=(const JSONCGIScheduler&) = delete;
+
+	/**
+	 * Coroutine which runs on its own on the scheduler and
+	 * deletes itself at the end. Created with spawn().
+	 **/
+	class Detached {
+	public:
+		struct promise_type {
+			std::shared_ptr<Core> core;
+			Detached get_return_object() {
+				return Detached(std::coroutine_handle<promise_type>::from_promise(*this));
+			}
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() {}
+			~promise_type() {
+				if (core) core->forget(std::coroutine_handle<promise_type>::from_promise(*this).address());
+			}
+		};
+		explicit Detached(std::coroutine_handle<promise_type> argHandle) : handle(argHandle) {}
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	/**
+	 * Starts the thread which runs the coroutines.
+	 **/
+	void start() {
+		if (core) return;
+		core = std::make_shared<Core>();
+		core->running = true;
+		thread = std::thread(&JSONCGIScheduler::run, core);
+	}
+
+	/**
+	 * Stops the thread and deletes all coroutines which are still
+	 * waiting. Requests they would have answered get
+	 * "500 Internal Server Error" or nothing if the handler has
+	 * already been stopped.
+	 **/
+	void stop() {
+		if (!core) return;
+		{
+			std::lock_guard<std::mutex> lock(core->mutex);
+			core->running = false;
+		}
+		core->wakeup.notify_all();
+		thread.join();
+		std::unordered_set<void*> frames;
+		{
+			std::lock_guard<std::mutex> lock(core->mutex);
+			frames.swap(core->frames);
+			core->ready.clear();
+			core->timers = decltype(core->timers)();
+		}
+		for(void* f : frames) {
+			std::coroutine_handle<>::from_address(f).destroy();
+		}
+		// events which arrive later go to the old core and are ignored
+		core.reset();
+	}
+
+	~JSONCGIScheduler() {
+		stop();
+	}
+
+	/**
+	 * Runs a coroutine on the scheduler. It can be called from any thread.
+	 * \param task The coroutine which hasn't started yet
+	 **/
+	void spawn(Detached task) {
+		if (!core) {
+			task.handle.destroy();
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(core->mutex);
+			if (core->running) {
+				task.handle.promise().core = core;
+				core->frames.insert(task.handle.address());
+				core->ready.push_back(task.handle);
+				task.handle = nullptr;
+			}
+		}
+		if (task.handle) {
+			task.handle.destroy();
+			return;
+		}
+		core->wakeup.notify_one();
+	}
+
+	/**
+	 * Awaitable which resumes the coroutine after a delay.
+	 **/
+	struct Sleep {
+		std::chrono::steady_clock::time_point due;
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h) { scheduled().addTimer(due, h); }
+		void await_resume() const noexcept {}
+	};
+
+	/**
+	 * \param duration Time to wait
+	 * \return Awaitable which resumes the coroutine after the duration
+	 **/
+	static Sleep sleepFor(std::chrono::steady_clock::duration duration) {
+		return Sleep{std::chrono::steady_clock::now() + duration};
+	}
+
+	/**
+	 * Awaitable which resumes the coroutine when the generation
+	 * of the data has been bumped, for example by a new sample.
+	 * It returns the new generation.
+	 **/
+	struct Change {
+		JSONCGIHandler::Generation& generation;
+		uint64_t seen;
+		bool await_ready() const { return generation.get() != seen; }
+		void await_suspend(std::coroutine_handle<> h) {
+			std::shared_ptr<Core> c = scheduled().shared_from_this();
+			generation.callOnChange(seen, [c, h]() { c->post(h); });
+		}
+		uint64_t await_resume() const { return generation.get(); }
+	};
+
+	/**
+	 * \param generation The generation counter of the data
+	 * \param seen The generation the coroutine has already got
+	 * \return Awaitable which resumes the coroutine once the
+	 *         generation has moved on from seen
+	 **/
+	static Change nextChange(JSONCGIHandler::Generation& generation, uint64_t seen) {
+		return Change{generation, seen};
+	}
+
+	/**
+	 * Resumes a coroutine on the scheduler of the current
+	 * coroutine. For awaitables which are triggered by other threads.
+	 * \return Function which can be called once from any thread
+	 **/
+	static std::function<void()> resumer(std::coroutine_handle<> h) {
+		std::shared_ptr<Core> c = scheduled().shared_from_this();
+		return [c, h]() { c->post(h); };
+	}
+
+private:
+	struct Timer {
+		std::chrono::steady_clock::time_point due;
+		uint64_t seq;
+		std::coroutine_handle<> handle;
+		bool operator>(const Timer& other) const {
+			if (due != other.due) return due > other.due;
+			return seq > other.seq;
+		}
+	};
+
+	/**
+	 * State shared with the awaitables which might outlive
+	 * the scheduler, for example in a generation counter.
+	 **/
+	struct Core : std::enable_shared_from_this<Core> {
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		std::deque<std::coroutine_handle<>> ready;
+		std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+		uint64_t nTimers = 0;
+		// frames of the spawned coroutines which haven't finished
+		std::unordered_set<void*> frames;
+		bool running = false;
+
+		void post(std::coroutine_handle<> h) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!running) return;
+				ready.push_back(h);
+			}
+			wakeup.notify_one();
+		}
+
+		void addTimer(std::chrono::steady_clock::time_point due, std::coroutine_handle<> h) {
+			std::lock_guard<std::mutex> lock(mutex);
+			timers.push(Timer{due, nTimers++, h});
+		}
+
+		void forget(void* frame) {
+			std::lock_guard<std::mutex> lock(mutex);
+			frames.erase(frame);
+		}
+	};
+
+	/**
+	 * The scheduler whose thread is running.
+	 **/
+	static Core*& current() {
+		static thread_local Core* c = nullptr;
+		return c;
+	}
+
+	/**
+	 * The scheduler of the awaiting coroutine. The exception
+	 * is thrown at the co_await in the coroutine.
+	 **/
+	static Core& scheduled() {
+		if (nullptr == current()) {
+			throw "Awaited by a coroutine which isn't running on a JSONCGIScheduler.";
+		}
+		return *current();
+	}
+
+	static void run(std::shared_ptr<Core> core) {
+		current() = core.get();
+		std::unique_lock<std::mutex> lock(core->mutex);
+		while (core->running) {
+			const auto now = std::chrono::steady_clock::now();
+			while (!core->timers.empty() && (core->timers.top().due <= now)) {
+				core->ready.push_back(core->timers.top().handle);
+				core->timers.pop();
+			}
+			if (core->ready.empty()) {
+				if (core->timers.empty()) {
+					core->wakeup.wait(lock);
+				} else {
+					core->wakeup.wait_until(lock, core->timers.top().due);
+				}
+				continue;
+			}
+			std::coroutine_handle<> h = core->ready.front();
+			core->ready.pop_front();
+			lock.unlock();
+			h.resume();
+			lock.lock();
+		}
+		current() = nullptr;
+	}
+
+	std::shared_ptr<Core> core;
+	std::thread thread;
+};
+
+/**
+ * Result of a coroutine which runs on the JSONCGIScheduler. It
+ * starts when it's awaited so coroutines can await each other:
+ *
+ *     JSONCGITask<float> average() { ... co_return v; }
+ *     ...
+ *     const float v = co_await average();
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+template<typename T>
+class JSONCGITask {
+	template<typename R>
+	struct Result {
+		std::optional<R> value;
+		void return_value(R v) { value = std::move(v); }
+		R get() { return std::move(*value); }
+	};
+	struct VoidResult {
+		void return_void() {}
+		void get() {}
+	};
+public:
+	struct promise_type : std::conditional_t<std::is_void_v<T>, VoidResult, Result<T>> {
+		std::coroutine_handle<> continuation;
+		std::exception_ptr error;
+		JSONCGITask get_return_object() {
+			return JSONCGITask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		struct FinalAwaiter {
+			bool await_ready() const noexcept { return false; }
+			// continues with the coroutine which has awaited it
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+				if (h.promise().continuation) return h.promise().continuation;
+				return std::noop_coroutine();
+			}
+			void await_resume() const noexcept {}
+		};
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	explicit JSONCGITask(std::coroutine_handle<promise_type> argHandle) : handle(argHandle) {}
+	JSONCGITask(JSONCGITask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	JSONCGITask(const JSONCGITask&) = delete;
+	JSONCGITask& operator=(const JSONCGITask&) = delete;
+	~JSONCGITask() {
+		if (handle) handle.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+	T await_resume() {
+		if (handle.promise().error) std::rethrow_exception(handle.promise().error);
+		return handle.promise().get();
+	}
+
+private:
+	std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * Event which coroutines can wait for and which is triggered
+ * by any thread. Every notify() resumes all coroutines which are
+ * waiting at that moment.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+class JSONCGIEvent {
+public:
+	/**
+	 * Resumes all waiting coroutines on their scheduler.
+	 **/
+	void notify() {
+		std::vector<std::function<void()>> due;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			due.swap(waiting);
+		}
+		for(auto& f : due) f();
+	}
+
+	struct Awaiter {
+		JSONCGIEvent& event;
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h) {
+			std::lock_guard<std::mutex> lock(event.mutex);
+			event.waiting.push_back(JSONCGIScheduler::resumer(h));
+		}
+		void await_resume() const noexcept {}
+	};
+
+	/**
+	 * Waits for the next notify().
+	 **/
+	Awaiter operator co_await() { return Awaiter{*this}; }
+
+private:
+	std::mutex mutex;
+	std::vector<std::function<void()>> waiting;
+};
+
+/**
+ * Timer which coroutines can wait for, for example a CppTimer:
+ *
+ *     JSONCGIAwaitableTimer<CppTimer> timer;
+ *     timer.startms(100, ONESHOT);
+ *     co_await timer;
+ *
+ * It waits for the next time the timer fires.
+ **/
+template<typename Timer>
+class JSONCGIAwaitableTimer : public Timer {
+public:
+	/**
+	 * Stops the timer before the event goes.
+	 **/
+	~JSONCGIAwaitableTimer() {
+		Timer::stop();
+	}
+	JSONCGIEvent::Awaiter operator co_await() { return fired.operator co_await(); }
+protected:
+	void timerEvent() override { fired.notify(); }
+private:
+	JSONCGIEvent fired;
+};
+
+/**
+ * Copy of the request for a coroutine which
+ * runs on after the callback has returned.
+ **/
+class JSONCGICoroRequest {
+public:
+	JSONCGICoroRequest() = default;
+	explicit JSONCGICoroRequest(const JSONCGIHandler::Request& request) :
+		path(request.getPath()), queryString(request.getQueryString()) {
+		for(const auto& p : request.getPathParameters()) {
+			pathParameters.emplace_back(std::string(p.first), std::string(p.second));
+		}
+	}
+	const std::string& getPath() const { return path; }
+	const std::string& getQueryString() const { return queryString; }
+	/**
+	 * \param name Name of the ':' segment of the route
+	 * \return Its value or an empty string
+	 **/
+	std::string getPathParameter(std::string_view name) const {
+		for(const auto& p : pathParameters) {
+			if (p.first == name) return p.second;
+		}
+		return "";
+	}
+	/**
+	 * \param name Name of the argument in the query string
+	 * \return Its decoded value or an empty string
+	 **/
+	std::string getQueryParameter(const std::string& name) const {
+		return JSONCGIHandler::getQueryParameter(queryString, name);
+	}
+private:
+	std::string path;
+	std::string queryString;
+	std::vector<std::pair<std::string, std::string>> pathParameters;
+};
+
+/**
+ * GET callback which is a coroutine. It runs on the scheduler
+ * and the JSON it returns with co_return is sent to the client.
+ * The parameters of the coroutine need to be passed by value
+ * because it runs on after the call.
+ **/
+class CoroGETCallback : public JSONCGIHandler::AsyncGETCallback {
+public:
+	CoroGETCallback(JSONCGIScheduler& argScheduler) : scheduler(argScheduler) {}
+
+	/**
+	 * Needs to co_return the JSON data.
+	 * \param request Copy of the request
+	 **/
+	virtual JSONCGITask<std::string> getJSONCoroutine(JSONCGICoroRequest request) = 0;
+
+	void getJSONStringAsync(std::shared_ptr<JSONCGIHandler::Responder> responder,
+				const JSONCGIHandler::Request& request) override {
+		scheduler.spawn(respond(getJSONCoroutine(JSONCGICoroRequest(request)), std::move(responder)));
+	}
+
+private:
+	static JSONCGIScheduler::Detached respond(JSONCGITask<std::string> task,
+						  std::shared_ptr<JSONCGIHandler::Responder> responder) {
+		try {
+			responder->respond(co_await task);
+		} catch (...) {
+			responder->respondStatus("500 Internal Server Error");
+		}
+	}
+
+	JSONCGIScheduler& scheduler;
+};
+
+/**
+ * POST callback which is a coroutine running on the scheduler.
+ * The reply is sent straight away and the coroutine executes
+ * the command afterwards. The parameters of the coroutine
+ * need to be passed by value.
+ **/
+class CoroPOSTCallback : public JSONCGIHandler::POSTCallback {
+public:
+	CoroPOSTCallback(JSONCGIScheduler& argScheduler) : scheduler(argScheduler) {}
+
+	/**
+	 * Receives the POST data.
+	 * \param request Copy of the request
+	 * \param data Copy of the POST data
+	 **/
+	virtual JSONCGITask<void> postCoroutine(JSONCGICoroRequest request, std::string data) = 0;
+
+	/**
+	 * Not used: the data is passed on to postCoroutine().
+	 **/
+	void postString(std::string postArg) override { (void)postArg; }
+
+	void postString(const JSONCGIHandler::Request& request, const char* data, size_t length) override {
+		scheduler.spawn(run(postCoroutine(JSONCGICoroRequest(request), std::string(data, length))));
+	}
+
+private:
+	static JSONCGIScheduler::Detached run(JSONCGITask<void> task) {
+		try {
+			co_await task;
+		} catch (...) {
+		}
+	}
+
+	JSONCGIScheduler& scheduler;
+};
+
+#endif
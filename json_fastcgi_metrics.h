@@ -0,0 +1,249 @@
+#ifndef JSON_FASTCGI_METRICS_H
+#define JSON_FASTCGI_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+/**
+ * Counters and latency histograms of a JSONCGIHandler which are
+ * served in the Prometheus text format. Every thread records into
+ * its own shard with relaxed atomic additions so that recording
+ * costs a few ns and never waits. The shards are added up when
+ * the metrics are scraped.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+class JSONCGIMetrics {
+public:
+	/**
+	 * Request methods which are counted separately.
+	 **/
+	enum class Method {GET, POST, OTHER};
+
+	/**
+	 * Histogram of durations with one bucket per power of two of
+	 * microseconds from 1us to 67s like an HDR histogram with the
+	 * lowest precision. Finding the bucket is a single bit scan.
+	 **/
+	class Histogram {
+	public:
+		// upper bounds 2^0 ... 2^26 us and +Inf
+		static const int nBuckets = 28;
+
+		/**
+		 * Adds a duration to the histogram.
+		 * \param d Duration, negative ones count as zero
+		 **/
+		void record(std::chrono::steady_clock::duration d) {
+			const int64_t t = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+			const uint64_t ns = (t < 0) ? 0 : (uint64_t)t;
+			buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+			sumNs.fetch_add(ns, std::memory_order_relaxed);
+		}
+
+		/**
+		 * \param ns Duration in ns
+		 * \return Index of the bucket with the smallest
+		 *         upper bound 2^i us which isn't less
+		 **/
+		static int bucket(uint64_t ns) {
+			const uint64_t us = (ns + 999) / 1000;
+			if (us <= 1) return 0;
+			const int i = 64 - __builtin_clzll(us - 1);
+			return (i < nBuckets - 1) ? i : nBuckets - 1;
+		}
+
+		std::atomic<uint64_t> buckets[nBuckets]{};
+		std::atomic<uint64_t> sumNs{0};
+	};
+
+	/**
+	 * Counts a finished request.
+	 * \param method Request method
+	 * \param status Status code of the response
+	 * \param bytesIn Received POST data
+	 * \param bytesOut Sent header and data
+	 **/
+	void addRequest(Method method, int status, uint64_t bytesIn, uint64_t bytesOut) {
+		Shard& s = local();
+		s.requests[(int)method][statusIndex(status)].fetch_add(1, std::memory_order_relaxed);
+		s.bytesIn.fetch_add(bytesIn, std::memory_order_relaxed);
+		s.bytesOut.fetch_add(bytesOut, std::memory_order_relaxed);
+	}
+
+	/**
+	 * \param d Time from the arrival of a request until a worker has taken it
+	 **/
+	void addAcceptWait(std::chrono::steady_clock::duration d) {
+		local().acceptWait.record(d);
+	}
+
+	/**
+	 * \param d Time spent in the callback of a route
+	 **/
+	void addCallbackTime(std::chrono::steady_clock::duration d) {
+		local().callback.record(d);
+	}
+
+	/**
+	 * \param d Time from the arrival of a request until it's finished
+	 **/
+	void addResponseTime(std::chrono::steady_clock::duration d) {
+		local().response.record(d);
+	}
+
+	/**
+	 * \param method Value of REQUEST_METHOD
+	 * \return The method which it's counted as
+	 **/
+	static Method getMethod(std::string_view method) {
+		if (method == "GET") return Method::GET;
+		if (method == "POST") return Method::POST;
+		return Method::OTHER;
+	}
+
+	/**
+	 * Takes the status code from the beginning of a response.
+	 * \param data The first bytes sent
+	 * \param length Number of bytes
+	 * \return The code of the "Status:" line or 200 if there is none
+	 **/
+	static int getStatus(const char* data, size_t length) {
+		if ((length < 11) || (strncmp(data, "Status: ", 8) != 0)) return 200;
+		int status = 0;
+		for(size_t i = 8; i < 11; i++) {
+			if ((data[i] < '0') || (data[i] > '9')) return 0;
+			status = status * 10 + (data[i] - '0');
+		}
+		return status;
+	}
+
+	/**
+	 * Adds up the shards.
+	 * \param inFlight Requests which are being processed right now
+	 * \return The metrics in the Prometheus text exposition format
+	 **/
+	std::string getPrometheusText(int inFlight) const {
+		uint64_t requests[nMethods][nStatus] = {};
+		uint64_t bytesIn = 0;
+		uint64_t bytesOut = 0;
+		for(const Shard& s : shards) {
+			for(int m = 0; m < nMethods; m++) {
+				for(int i = 0; i < nStatus; i++) {
+					requests[m][i] += s.requests[m][i].load(std::memory_order_relaxed);
+				}
+			}
+			bytesIn += s.bytesIn.load(std::memory_order_relaxed);
+			bytesOut += s.bytesOut.load(std::memory_order_relaxed);
+		}
+		static const char* methods[nMethods] = {"GET", "POST", "other"};
+		std::string text = "# HELP jsoncgi_requests_total Finished requests by method and status code.\n";
+		text += "# TYPE jsoncgi_requests_total counter\n";
+		for(int m = 0; m < nMethods; m++) {
+			for(int i = 0; i < nStatus; i++) {
+				if (0 == requests[m][i]) continue;
+				const std::string status = (i < nStatus - 1) ? std::to_string(statusCodes[i]) : "other";
+				text += "jsoncgi_requests_total{method=\"" + std::string(methods[m]) +
+					"\",status=\"" + status + "\"} " + std::to_string(requests[m][i]) + "\n";
+			}
+		}
+		text += "# HELP jsoncgi_requests_in_flight Requests which are being processed.\n";
+		text += "# TYPE jsoncgi_requests_in_flight gauge\n";
+		text += "jsoncgi_requests_in_flight " + std::to_string(inFlight) + "\n";
+		appendHistogram(text, "jsoncgi_accept_wait_seconds",
+				"Time requests have waited for a worker.", &Shard::acceptWait);
+		appendHistogram(text, "jsoncgi_callback_seconds",
+				"Time spent in the callbacks.", &Shard::callback);
+		appendHistogram(text, "jsoncgi_response_seconds",
+				"Time from the arrival of a request until it was finished.", &Shard::response);
+		text += "# HELP jsoncgi_received_bytes_total Received POST data.\n";
+		text += "# TYPE jsoncgi_received_bytes_total counter\n";
+		text += "jsoncgi_received_bytes_total " + std::to_string(bytesIn) + "\n";
+		text += "# HELP jsoncgi_sent_bytes_total Sent headers and data.\n";
+		text += "# TYPE jsoncgi_sent_bytes_total counter\n";
+		text += "jsoncgi_sent_bytes_total " + std::to_string(bytesOut) + "\n";
+		return text;
+	}
+
+private:
+	static const int nMethods = 3;
+	// the codes the handler sends and one for all others
+	static constexpr int statusCodes[] = {200, 304, 400, 404, 405, 413, 500, 503};
+	static const int nStatus = sizeof(statusCodes) / sizeof(statusCodes[0]) + 1;
+	static const int nShards = 16;
+
+	static int statusIndex(int status) {
+		for(int i = 0; i < nStatus - 1; i++) {
+			if (statusCodes[i] == status) return i;
+		}
+		return nStatus - 1;
+	}
+
+	/**
+	 * Counters of the threads which share it. Aligned to
+	 * cache lines so that shards don't slow each other down.
+	 **/
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> requests[nMethods][nStatus]{};
+		std::atomic<uint64_t> bytesIn{0};
+		std::atomic<uint64_t> bytesOut{0};
+		Histogram acceptWait;
+		Histogram callback;
+		Histogram response;
+	};
+
+	/**
+	 * \return The shard of the calling thread
+	 **/
+	Shard& local() {
+		static std::atomic<unsigned> threads{0};
+		static thread_local const unsigned index = threads.fetch_add(1);
+		return shards[index % nShards];
+	}
+
+	/**
+	 * Adds up a histogram of all shards and appends it with
+	 * cumulative buckets as Prometheus expects them.
+	 **/
+	void appendHistogram(std::string& text, const char* name, const char* help,
+			     Histogram Shard::*histogram) const {
+		uint64_t buckets[Histogram::nBuckets] = {};
+		uint64_t sumNs = 0;
+		for(const Shard& s : shards) {
+			const Histogram& h = s.*histogram;
+			for(int i = 0; i < Histogram::nBuckets; i++) {
+				buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+			}
+			sumNs += h.sumNs.load(std::memory_order_relaxed);
+		}
+		text += "# HELP " + std::string(name) + " " + help + "\n";
+		text += "# TYPE " + std::string(name) + " histogram\n";
+		uint64_t count = 0;
+		char line[128];
+		for(int i = 0; i < Histogram::nBuckets; i++) {
+			count += buckets[i];
+			if (i < Histogram::nBuckets - 1) {
+				snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n",
+					 name, (double)(1ULL << i) * 1e-6, (unsigned long long)count);
+			} else {
+				snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n",
+					 name, (unsigned long long)count);
+			}
+			text += line;
+		}
+		snprintf(line, sizeof(line), "%s_sum %.9f\n", name, (double)sumNs * 1e-9);
+		text += line;
+		snprintf(line, sizeof(line), "%s_count %llu\n", name, (unsigned long long)count);
+		text += line;
+	}
+
+	Shard shards[nShards];
+};
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef JSON_FASTCGI_TRACE_H
+#define JSON_FASTCGI_TRACE_H
+
+/**
+ * Per-request phase tracing. JSONCGI_TRACE("name") records the time
+ * from where it's placed to the end of the block into a ring buffer
+ * which can be saved in the Chrome trace event format and viewed
+ * with chrome://tracing or https://ui.perfetto.dev. Without
+ * JSONCGI_TRACING defined the macro is empty and nothing is compiled in.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+
+#ifdef JSONCGI_TRACING
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#ifndef JSONCGI_TRACE_EVENTS
+// number of events kept, the oldest ones are overwritten
+#define JSONCGI_TRACE_EVENTS 16384
+#endif
+
+#define JSONCGI_TRACE_CONCAT2(a, b) a##b
+#define JSONCGI_TRACE_CONCAT(a, b) JSONCGI_TRACE_CONCAT2(a, b)
+#define JSONCGI_TRACE(name) JSONCGITrace::Span JSONCGI_TRACE_CONCAT(jsoncgiTraceSpan, __LINE__)(name)
+
+/**
+ * Ring buffer of the most recent phases of all threads. Recording
+ * claims a slot with one atomic addition and never waits. Every slot
+ * has a sequence number so that a dump skips the slots which are
+ * being overwritten at that moment.
+ **/
+class JSONCGITrace {
+public:
+	static const size_t nEvents = JSONCGI_TRACE_EVENTS;
+
+	/**
+	 * Records the time from its construction to its destruction.
+	 **/
+	class Span {
+	public:
+		/**
+		 * \param argName String literal which names the phase
+		 **/
+		Span(const char* argName) : name(argName), begin(std::chrono::steady_clock::now()) {}
+		~Span() {
+			get().add(name, begin, std::chrono::steady_clock::now());
+		}
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+	private:
+		const char* name;
+		const std::chrono::steady_clock::time_point begin;
+	};
+
+	/**
+	 * \return The ring buffer of the process
+	 **/
+	static JSONCGITrace& get() {
+		static JSONCGITrace trace;
+		return trace;
+	}
+
+	/**
+	 * Records a phase.
+	 * \param name String literal which names the phase
+	 * \param begin Start of the phase
+	 * \param end End of the phase
+	 **/
+	void add(const char* name, std::chrono::steady_clock::time_point begin,
+		 std::chrono::steady_clock::time_point end) {
+		const uint64_t n = next.fetch_add(1, std::memory_order_relaxed);
+		Event& e = events[n % nEvents];
+		// odd while it's being written
+		e.seq.store(2 * n + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		e.name.store(name, std::memory_order_relaxed);
+		e.beginNs.store(toNs(begin), std::memory_order_relaxed);
+		e.durationNs.store(toNs(end) - toNs(begin), std::memory_order_relaxed);
+		e.thread.store(threadId(), std::memory_order_relaxed);
+		e.seq.store(2 * n + 2, std::memory_order_release);
+	}
+
+	/**
+	 * \return The recorded phases, oldest first, in the Chrome trace event format
+	 **/
+	std::string getChromeJSON() const {
+		std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		const uint64_t end = next.load(std::memory_order_acquire);
+		const uint64_t start = (end > nEvents) ? end - nEvents : 0;
+		const int pid = (int)getpid();
+		bool first = true;
+		char line[192];
+		for(uint64_t n = start; n < end; n++) {
+			const Event& e = events[n % nEvents];
+			const uint64_t seq = e.seq.load(std::memory_order_acquire);
+			if (seq != 2 * n + 2) continue;
+			const char* name = e.name.load(std::memory_order_relaxed);
+			const uint64_t beginNs = e.beginNs.load(std::memory_order_relaxed);
+			const uint64_t durationNs = e.durationNs.load(std::memory_order_relaxed);
+			const unsigned thread = e.thread.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			// overwritten while it was read
+			if (e.seq.load(std::memory_order_relaxed) != seq) continue;
+			snprintf(line, sizeof(line),
+				 "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+				 first ? "" : ",\n", name, (double)beginNs * 1e-3, (double)durationNs * 1e-3,
+				 pid, thread);
+			json += line;
+			first = false;
+		}
+		json += "]}\n";
+		return json;
+	}
+
+	/**
+	 * Saves the recorded phases in the Chrome trace event format.
+	 * \param filename Path of the file
+	 * \return false if it couldn't be written
+	 **/
+	bool writeChromeJSON(const char* filename) const {
+		FILE* f = fopen(filename, "w");
+		if (nullptr == f) return false;
+		const std::string json = getChromeJSON();
+		const bool ok = fwrite(json.data(), 1, json.length(), f) == json.length();
+		return (fclose(f) == 0) && ok;
+	}
+
+private:
+	JSONCGITrace() = default;
+
+	struct Event {
+		std::atomic<uint64_t> seq{0};
+		std::atomic<const char*> name{nullptr};
+		std::atomic<uint64_t> beginNs{0};
+		std::atomic<uint64_t> durationNs{0};
+		std::atomic<unsigned> thread{0};
+	};
+
+	static uint64_t toNs(std::chrono::steady_clock::time_point t) {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+	}
+
+	/**
+	 * \return A small number for the calling thread
+	 **/
+	static unsigned threadId() {
+		static std::atomic<unsigned> threads{0};
+		static thread_local const unsigned id = threads.fetch_add(1) + 1;
+		return id;
+	}
+
+	std::atomic<uint64_t> next{0};
+	Event events[nEvents];
+};
+
+#else
+
+#define JSONCGI_TRACE(name)
+
+#endif
+
+#endif
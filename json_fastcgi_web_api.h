@@ -5,7 +5,9 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/signal.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -13,6 +15,22 @@
 #include <fcgio.h>
 #include <thread>
 #include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <string_view>
+#include <charconv>
+#include <algorithm>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "fastcgi_native.h"
+#include "json_fastcgi_metrics.h"
 
 /**
  * C++ wrapper around fastCGI which sends and receives JSON
@@ -24,7 +42,381 @@
 class JSONCGIHandler {
 public:
 	JSONCGIHandler() = default;
+
+	/**
+	 * Implementation of the fastCGI protocol.
+	 **/
+	enum class Backend {
+		/**
+		 * libfcgi: every worker blocks in FCGX_Accept_r() and
+		 * the web server opens a new connection per request.
+		 **/
+		LIBFCGI,
+		/**
+		 * Built-in event loop which keeps connections open for
+		 * further requests (nginx: fastcgi_keep_conn on) and
+		 * accepts several requests at a time on one connection.
+		 **/
+		NATIVE
+	};
+
+	/**
+	 * Priority of a route when the handler is overloaded.
+	 * POST requests are never rejected.
+	 **/
+	enum class Priority {
+		/**
+		 * Rejected at half of the limits, for example bulk history downloads.
+		 **/
+		LOW,
+		/**
+		 * Rejected at the limits.
+		 **/
+		NORMAL,
+		/**
+		 * Never rejected.
+		 **/
+		HIGH
+	};
 	
+	/**
+	 * Generation counter which is owned by the data source and
+	 * bumped whenever its data has changed. It lets the handler
+	 * know if a previously rendered response is still up to date.
+	 **/
+	class Generation {
+	public:
+		/**
+		 * Marks the data as changed. Call it after the data has been updated.
+		 **/
+		void bump() {
+			generation++;
+			std::vector<std::function<void()>> due;
+			{
+				std::lock_guard<std::mutex> lock(waitMutex);
+				changed.notify_all();
+				due.swap(onChange);
+			}
+			for(auto& f : due) f();
+		}
+		/**
+		 * Current generation of the data.
+		 * \return Generation number which increases with every change
+		 **/
+		uint64_t get() const { return generation.load(); }
+		/**
+		 * Quoted entity tag of the current generation. It contains the
+		 * creation time of the counter so that the tags differ after a restart.
+		 * \return ETag of the current generation
+		 **/
+		std::string getETag() const {
+			return "\"" + std::to_string(instance) + "-" + std::to_string(get()) + "\"";
+		}
+		/**
+		 * Blocks until the generation has moved on from the one
+		 * already seen or the timeout has expired. It might also return
+		 * early without a change when woken up by notifyAll().
+		 * \param seen The generation the caller has already got
+		 * \param timeoutMs Timeout in milliseconds
+		 * \return true if the generation has changed
+		 **/
+		bool waitForChange(uint64_t seen, int timeoutMs) {
+			std::unique_lock<std::mutex> lock(waitMutex);
+			if (get() == seen) {
+				changed.wait_for(lock, std::chrono::milliseconds(timeoutMs));
+			}
+			return get() != seen;
+		}
+		/**
+		 * Calls a function once when the generation has moved on from
+		 * the one already seen, without a thread waiting for it. It's
+		 * called by the thread which calls bump() or straight away if
+		 * the generation has already changed.
+		 * \param seen The generation the caller has already got
+		 * \param f Function which must not block
+		 **/
+		void callOnChange(uint64_t seen, std::function<void()> f) {
+			{
+				std::lock_guard<std::mutex> lock(waitMutex);
+				if (get() == seen) {
+					onChange.push_back(std::move(f));
+					return;
+				}
+			}
+			f();
+		}
+		/**
+		 * Wakes up all threads blocking in waitForChange().
+		 **/
+		void notifyAll() {
+			std::lock_guard<std::mutex> lock(waitMutex);
+			changed.notify_all();
+		}
+	private:
+		std::atomic<uint64_t> generation{1};
+		const uint64_t instance = (uint64_t)time(NULL);
+		std::mutex waitMutex;
+		std::condition_variable changed;
+		std::vector<std::function<void()>> onChange;
+	};
+
+	/**
+	 * Receives the body of a response in pieces. It's
+	 * passed on to the web server as the pieces arrive so that
+	 * the whole response never needs to be in memory.
+	 **/
+	class ResponseWriter {
+	public:
+		virtual ~ResponseWriter() = default;
+		/**
+		 * Sends a piece of the response.
+		 * \param data Pointer to the data
+		 * \param length Number of bytes
+		 * \return false if the web server has closed the connection
+		 **/
+		virtual bool write(const char* data, size_t length) = 0;
+		/**
+		 * Sends a piece of the response.
+		 * \param data The data
+		 * \return false if the web server has closed the connection
+		 **/
+		bool write(const std::string& data) {
+			return write(data.data(), data.length());
+		}
+	};
+
+	/**
+	 * The request which is being served: its path, query string,
+	 * the parameters taken from the path by the route, the fastCGI
+	 * parameters and the HTTP headers. The fastCGI parameters are
+	 * put into a hash table once when the request arrives and the
+	 * query string is decoded once when it's first needed. All
+	 * values are views of the request's memory which are only
+	 * valid during the call of the callback.
+	 **/
+	class Request {
+	public:
+		Request() = default;
+		/**
+		 * \param argPath Path of the URL, for example "/sensor/temp"
+		 * \param argQueryString Query string without the '?'
+		 **/
+		Request(std::string_view argPath, std::string_view argQueryString) :
+			path(argPath), queryString(argQueryString) {}
+		// the views of the decoded query would point into the original
+		Request(const Request&) = delete;
+		Request& operator=(const Request&) = delete;
+		/**
+		 * \return The path of the URL, for example "/sensor/temp"
+		 **/
+		std::string_view getPath() const { return path; }
+		/**
+		 * \return The query string of the URL without the '?'
+		 **/
+		std::string_view getQueryString() const { return queryString; }
+		/**
+		 * Gets a ":name" segment of the route. For example for
+		 * the route "/sensor/:channel" and the path "/sensor/temp"
+		 * the parameter "channel" is "temp".
+		 * \param name Name of the parameter without the ':'
+		 * \return The value or an empty view if there is none
+		 **/
+		std::string_view getPathParameter(std::string_view name) const {
+			for(const auto& p : pathParameters) {
+				if (p.first == name) return p.second;
+			}
+			return std::string_view();
+		}
+		/**
+		 * \return Names and values of all ":name" segments of the route
+		 **/
+		const std::vector<std::pair<std::string_view, std::string_view>>& getPathParameters() const {
+			return pathParameters;
+		}
+		/**
+		 * Gets a fastCGI parameter with one hash lookup.
+		 * \param name Name of the parameter, for example "REMOTE_ADDR"
+		 * \return The value or an empty view if not present
+		 **/
+		std::string_view getParam(std::string_view name) const {
+			return lookup(hash(2166136261u, name), [name](std::string_view key) {
+				return key == name;
+			});
+		}
+		/**
+		 * Gets an HTTP header of the request with one hash lookup.
+		 * \param name Name of the header in any case, for example "If-None-Match"
+		 * \return The value or an empty view if not present
+		 **/
+		std::string_view getHeader(std::string_view name) const {
+			uint32_t h = hash(2166136261u, "HTTP_");
+			for(const char c : name) h = hash(h, headerChar(c));
+			return lookup(h, [name](std::string_view key) {
+				if ((key.length() != name.length() + 5) || (key.compare(0, 5, "HTTP_") != 0)) {
+					return false;
+				}
+				for(size_t i = 0; i < name.length(); i++) {
+					if (key[i + 5] != headerChar(name[i])) return false;
+				}
+				return true;
+			});
+		}
+		/**
+		 * Gets a decoded argument of the query string. "+" and
+		 * %-escapes are decoded once for all arguments when the
+		 * first one is asked for.
+		 * \param name Name of the argument, for example "since"
+		 * \return The value or an empty view if not present
+		 **/
+		std::string_view getQueryArg(std::string_view name) const {
+			if (!queryDecoded) decodeQuery();
+			for(const auto& a : queryArgs) {
+				if (a.first == name) return a.second;
+			}
+			return std::string_view();
+		}
+		/**
+		 * Gets a decoded argument of the query string as a string.
+		 * \param name Name of the argument
+		 * \return The value or an empty string if not present
+		 **/
+		std::string getQueryParameter(std::string_view name) const {
+			return std::string(getQueryArg(name));
+		}
+	private:
+		friend class JSONCGIHandler;
+
+		struct Param {
+			uint32_t hash = 0;
+			std::string_view name;
+			std::string_view value;
+		};
+
+		/**
+		 * Puts the "NAME=value" strings of the fastCGI request into
+		 * an open addressing hash table. Its memory is reused for the
+		 * next request.
+		 **/
+		void index(char** envp) {
+			JSONCGI_TRACE("params");
+			size_t n = 0;
+			while ((nullptr != envp) && (nullptr != envp[n])) n++;
+			size_t size = 64;
+			while (size < 2 * n) size *= 2;
+			params.assign(size, Param());
+			for(size_t i = 0; i < n; i++) {
+				const char* eq = strchr(envp[i], '=');
+				if (nullptr == eq) continue;
+				Param p;
+				p.name = std::string_view(envp[i], eq - envp[i]);
+				p.value = std::string_view(eq + 1);
+				p.hash = hash(2166136261u, p.name);
+				size_t slot = p.hash & (size - 1);
+				while (nullptr != params[slot].name.data()) {
+					// the first one wins as with FCGX_GetParam()
+					if (params[slot].name == p.name) break;
+					slot = (slot + 1) & (size - 1);
+				}
+				if (nullptr == params[slot].name.data()) params[slot] = p;
+			}
+			queryDecoded = false;
+			pathParameters.clear();
+		}
+
+		template<typename Equal>
+		std::string_view lookup(uint32_t h, Equal equal) const {
+			if (params.empty()) return std::string_view();
+			size_t slot = h & (params.size() - 1);
+			while (nullptr != params[slot].name.data()) {
+				if ((params[slot].hash == h) && equal(params[slot].name)) {
+					return params[slot].value;
+				}
+				slot = (slot + 1) & (params.size() - 1);
+			}
+			return std::string_view();
+		}
+
+		/**
+		 * FNV-1a
+		 **/
+		static uint32_t hash(uint32_t h, char c) {
+			return (h ^ (unsigned char)c) * 16777619u;
+		}
+
+		static uint32_t hash(uint32_t h, std::string_view s) {
+			for(const char c : s) h = hash(h, c);
+			return h;
+		}
+
+		/**
+		 * nginx passes "If-None-Match" as "HTTP_IF_NONE_MATCH".
+		 **/
+		static char headerChar(char c) {
+			if (c == '-') return '_';
+			return (char)toupper((unsigned char)c);
+		}
+
+		static int hexDigit(char c) {
+			if ((c >= '0') && (c <= '9')) return c - '0';
+			if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+			if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+			return -1;
+		}
+
+		/**
+		 * Appends the decoded text to the query buffer.
+		 * \return View of the decoded text
+		 **/
+		std::string_view decode(std::string_view s) const {
+			const size_t start = queryBuffer.length();
+			for(size_t i = 0; i < s.length(); i++) {
+				if (s[i] == '+') {
+					queryBuffer += ' ';
+				} else if ((s[i] == '%') && (i + 2 < s.length()) &&
+					   (hexDigit(s[i+1]) >= 0) && (hexDigit(s[i+2]) >= 0)) {
+					queryBuffer += (char)(hexDigit(s[i+1]) * 16 + hexDigit(s[i+2]));
+					i += 2;
+				} else {
+					queryBuffer += s[i];
+				}
+			}
+			return std::string_view(queryBuffer.data() + start, queryBuffer.length() - start);
+		}
+
+		void decodeQuery() const {
+			queryArgs.clear();
+			queryBuffer.clear();
+			// decoding never makes the text longer so the buffer
+			// isn't reallocated and the views stay valid
+			queryBuffer.reserve(queryString.length());
+			size_t pos = 0;
+			while (pos < queryString.length()) {
+				size_t end = queryString.find('&', pos);
+				if (end == std::string_view::npos) end = queryString.length();
+				const std::string_view arg = queryString.substr(pos, end - pos);
+				if (!arg.empty()) {
+					const size_t eq = arg.find('=');
+					const std::string_view key = decode(arg.substr(0, eq));
+					const std::string_view value = (eq == std::string_view::npos) ?
+						std::string_view() : decode(arg.substr(eq + 1));
+					queryArgs.emplace_back(key, value);
+				}
+				pos = end + 1;
+			}
+			queryDecoded = true;
+		}
+
+		std::string_view path;
+		std::string_view queryString;
+		// SCRIPT_NAME and PATH_INFO if there is no DOCUMENT_URI
+		std::string pathBuffer;
+		std::vector<std::pair<std::string_view, std::string_view>> pathParameters;
+		std::vector<Param> params;
+		mutable bool queryDecoded = false;
+		mutable std::string queryBuffer;
+		mutable std::vector<std::pair<std::string_view, std::string_view>> queryArgs;
+	};
+
 	/**
 	 * GET callback handler which needs to be implemented by the main
 	 * program. This needs to provide the JSON payload.
@@ -36,14 +428,186 @@ public:
 		 * \return JSON data
 		 **/
 		virtual std::string getJSONString() = 0;
+		/**
+		 * Needs to return the JSON data for a request with a query
+		 * string, for example "since=1700000000000". By default the
+		 * query is ignored. Use getQueryParameter() to decode it.
+		 * \param queryString The query string of the URL without the '?'
+		 * \return JSON data
+		 **/
+		virtual std::string getJSONString(const std::string& queryString) {
+			(void)queryString;
+			return getJSONString();
+		}
+		/**
+		 * Needs to return the JSON data for a request which needs
+		 * more than the query string, for example the path parameters
+		 * of its route. By default it's passed on to getJSONString(queryString).
+		 * \param request The path, query string and path parameters
+		 * \return JSON data
+		 **/
+		virtual std::string getJSONString(const Request& request) {
+			return getJSONString(std::string(request.getQueryString()));
+		}
+		/**
+		 * Writes the JSON data in pieces while it's being produced
+		 * instead of returning it as one string. That's for large
+		 * responses which would otherwise need to be kept in memory
+		 * several times. By default the string from getJSONString() is written.
+		 * \param writer Receives the JSON data in pieces
+		 * \param request The path, query string and path parameters
+		 **/
+		virtual void writeJSONString(ResponseWriter& writer, const Request& request) {
+			writer.write(getJSONString(request));
+		}
 		/**
 		 * The content type of the payload. That's by default
 		 * "application/json" but can be overloaded if needed.
 		 * \return MIME type
 		 **/
 		virtual std::string getContentType() { return "application/json"; }
+		/**
+		 * Opt-in response cache. If the generation counter of the data
+		 * is returned here then the rendered response is kept and sent
+		 * again without calling getJSONString() until the generation
+		 * has changed.
+		 * \return Pointer to the generation counter or nullptr for no caching
+		 **/
+		virtual Generation* getGeneration() { return nullptr; }
+		/**
+		 * Entity tag of the current data. If the browser already has it
+		 * then a bodiless 304 is sent instead of the data. By default it's
+		 * derived from the generation counter if there is one.
+		 * \return Quoted ETag or an empty string for none
+		 **/
+		virtual std::string getETag() {
+			Generation* generation = getGeneration();
+			if (nullptr == generation) return "";
+			return generation->getETag();
+		}
+		/**
+		 * Time in seconds the browser or nginx (fastcgi_cache) may keep
+		 * the response without asking again.
+		 * \return max-age in seconds or a negative value for no max-age
+		 **/
+		virtual int getMaxAge() { return -1; }
+		/**
+		 * The data sent as a server-sent event to browsers which have
+		 * opened an EventSource on the URL. An event is sent whenever
+		 * the generation returned by getGeneration() changes so
+		 * streaming needs the generation counter. By default it's the
+		 * same data as returned by getJSONString().
+		 * \return JSON data of the event
+		 **/
+		virtual std::string getEventString() { return getJSONString(); }
+	};
+
+ private:
+	struct AsyncResponses;
+
+public:
+	/**
+	 * Answers a request of an AsyncGETCallback later from any
+	 * thread. The worker which has received the request is
+	 * meanwhile serving other requests.
+	 **/
+	class Responder {
+	public:
+		Responder(const Responder&) = delete;
+		Responder& operator=(const Responder&) = delete;
+		/**
+		 * Sends the JSON data. Only the first call of respond() or
+		 * respondStatus() has an effect.
+		 * \param json JSON data
+		 * \return false if the request has already been answered or
+		 *         the handler has been stopped meanwhile
+		 **/
+		bool respond(const std::string& json) {
+			return complete(nullptr, json.data(), json.length());
+		}
+		/**
+		 * Sends a reply without a body.
+		 * \param status Status code and text, for example "503 Service Unavailable"
+		 * \return false if the request has already been answered or
+		 *         the handler has been stopped meanwhile
+		 **/
+		bool respondStatus(const char* status) {
+			return complete(status, nullptr, 0);
+		}
+		/**
+		 * A request which is never answered gets "500 Internal Server Error".
+		 **/
+		~Responder() {
+			complete("500 Internal Server Error", nullptr, 0);
+		}
+	private:
+		friend class JSONCGIHandler;
+
+		Responder(const std::shared_ptr<AsyncResponses>& argResponses,
+			  std::unique_ptr<FastCGIExchange> argExchange,
+			  const std::string& argHeader) :
+			responses(argResponses), exchange(std::move(argExchange)), header(argHeader) {}
+
+		/**
+		 * Takes the request out of the list of pending ones so that
+		 * stop() can't answer it at the same time and then sends the reply.
+		 **/
+		bool complete(const char* status, const char* data, size_t length) {
+			std::unique_ptr<FastCGIExchange> e;
+			{
+				std::lock_guard<std::mutex> lock(responses->mutex);
+				if (!exchange) return false;
+				e = std::move(exchange);
+				responses->pending.erase(this);
+				responses->busy++;
+			}
+			bool ok = true;
+			if (nullptr != status) {
+				sendStatus(*e, status);
+			} else {
+				ok = e->write(header.data(), header.length()) &&
+					e->write(data, length) &&
+					e->write("\r\n", 2);
+			}
+			// finishes the request
+			e.reset();
+			responses->inFlight->fetch_sub(1);
+			{
+				std::lock_guard<std::mutex> lock(responses->mutex);
+				responses->busy--;
+			}
+			responses->idle.notify_all();
+			return ok;
+		}
+
+		std::shared_ptr<AsyncResponses> responses;
+		// guarded by the mutex of the responses
+		std::unique_ptr<FastCGIExchange> exchange;
+		std::string header;
 	};
 
+	/**
+	 * GET callback which answers requests later, for example when
+	 * a sensor has been read or from a thread pool. Slow I/O then
+	 * doesn't block the workers. Requests are neither cached nor
+	 * served as event streams.
+	 **/
+	class AsyncGETCallback : public GETCallback {
+	public:
+		/**
+		 * Receives a request and needs to answer it by calling
+		 * respond() on the responder now or later from any thread.
+		 * The views of the request are only valid during the call
+		 * so the values needed later have to be copied.
+		 * \param responder Sends the reply
+		 * \param request The path, query string and path parameters
+		 **/
+		virtual void getJSONStringAsync(std::shared_ptr<Responder> responder, const Request& request) = 0;
+		/**
+		 * Not used: the data is sent by the responder.
+		 **/
+		std::string getJSONString() override { return ""; }
+	};
 
 	/**
 	 * Callback handler which needs to be implemented by the main
@@ -56,108 +620,1331 @@ public:
 		 * \param postArg POST data received from jQuery
 		 **/
 		virtual void postString(std::string postArg) = 0;
+		/**
+		 * Receives the POST JSON data from the web browser without
+		 * copying it into a string. The data is in a receive buffer
+		 * which is reused for the next request so it's only valid
+		 * during the call. It's zero terminated. By default the
+		 * data is copied into a string and passed on to postString(std::string).
+		 * \param data Pointer to the POST data
+		 * \param length Number of bytes received
+		 **/
+		virtual void postString(const char* data, size_t length) {
+			postString(std::string(data, length));
+		}
+		/**
+		 * Receives the POST data of a request which needs more than
+		 * the data, for example the path parameters of its route.
+		 * By default it's passed on to postString(data, length).
+		 * \param request The path, query string and path parameters
+		 * \param data Pointer to the POST data
+		 * \param length Number of bytes received
+		 **/
+		virtual void postString(const Request& request, const char* data, size_t length) {
+			(void)request;
+			postString(data, length);
+		}
 	};
-	
+
 	/**
-	 * Opens the connection and starts the main thread.
+	 * POST callback which receives the data in pieces while it
+	 * arrives from the web server instead of in one buffer. For
+	 * large uploads which are processed while they are received,
+	 * for example with the JSONSAXParser. There is no size limit.
+	 **/
+	class StreamingPOSTCallback : public POSTCallback {
+	public:
+		/**
+		 * Not used: the data is passed on to the receiver.
+		 **/
+		void postString(std::string postArg) override { (void)postArg; }
+		/**
+		 * Receives the data of one POST request.
+		 **/
+		class Receiver {
+		public:
+			virtual ~Receiver() = default;
+			/**
+			 * Receives the next piece of the POST data. It's in a
+			 * buffer which is reused so it's only valid during the call.
+			 * \param data Pointer to the data
+			 * \param length Number of bytes
+			 * \return false to abort the request with "400 Bad Request"
+			 **/
+			virtual bool postChunk(const char* data, size_t length) = 0;
+			/**
+			 * Called after all data has been received.
+			 * \return false to reply with "400 Bad Request"
+			 **/
+			virtual bool postEnd() { return true; }
+			/**
+			 * The content type of the reply to the POST request.
+			 * \return MIME type
+			 **/
+			virtual std::string getContentType() { return "text/html"; }
+			/**
+			 * The reply to the POST request which is sent after postEnd().
+			 * \return The body of the reply
+			 **/
+			virtual std::string getResponseString() { return "<html></html>"; }
+		};
+		/**
+		 * Called when a POST request arrives. The receiver
+		 * is deleted once the request has been answered.
+		 * \param contentLength Number of bytes which will arrive
+		 * \return The receiver for the data or nullptr to reply
+		 *         with "400 Bad Request" without reading the data
+		 **/
+		virtual std::unique_ptr<Receiver> postBegin(size_t contentLength) {
+			(void)contentLength;
+			return nullptr;
+		}
+		/**
+		 * Called when a POST request arrives which needs more than its
+		 * length, for example the path parameters of its route. By
+		 * default it's passed on to postBegin(contentLength).
+		 * \param request The path, query string and path parameters
+		 * \param contentLength Number of bytes which will arrive
+		 * \return The receiver or nullptr to reply with "400 Bad Request"
+		 **/
+		virtual std::unique_ptr<Receiver> postBegin(const Request& request, size_t contentLength) {
+			(void)request;
+			return postBegin(contentLength);
+		}
+	};
+
+	/**
+	 * Adds a route with its own callbacks. Requests are routed by
+	 * their path: DOCUMENT_URI or, if nginx doesn't send it,
+	 * SCRIPT_NAME and PATH_INFO. Segments starting with ':' match any
+	 * segment and are passed on as path parameters, for example
+	 * "/sensor/:channel". Requests which match no route go to the
+	 * callbacks passed to start(). Needs to be called before start().
+	 * \param path The path, for example "/sensor/temp"
+	 * \param argGetCallback Callback handler for sending JSON or nullptr
+	 * \param argPostCallback Callback handler for receiving JSON or nullptr
+	 * \param priority Priority of its GET requests when overloaded
+	 **/
+	void addRoute(const std::string& path,
+		      GETCallback* argGetCallback,
+		      POSTCallback* argPostCallback = nullptr,
+		      Priority priority = Priority::NORMAL) {
+		std::unique_ptr<Route> route(new Route);
+		route->path = Router::normalise(path);
+		route->priority = priority;
+		route->setCallbacks(argGetCallback, argPostCallback);
+		routes.push_back(std::move(route));
+	}
+
+	/**
+	 * Opens the connection and starts the worker threads.
 	 * \param argGetCallback Callback handler for sending JSON
+	 *        for requests which match no route or nullptr
 	 * \param argPostCallback Callback handler for receiving JSON
+	 *        for requests which match no route
 	 * \param socketpath Path of the socket which communicates to the webserver
+	 * \param nWorkers Number of worker threads accepting requests in parallel.
+	 *        The callbacks are then called concurrently and need to be thread safe.
 	 **/
 	void start(
 		GETCallback* argGetCallback,
 		POSTCallback* argPostCallback = nullptr,
-		const char socketpath[] = "/tmp/fastcgisocket") {
-		getCallback = argGetCallback;
-		postCallback = argPostCallback;
-		// set it to zero
-		memset(&request, 0, sizeof(FCGX_Request));
-		// init the connection
-		FCGX_Init();
-		// open the socket
-		sock_fd = FCGX_OpenSocket(socketpath, 1024);
-		if (sock_fd < 0) {
-			std::string s = "Could not open socket. Error: "+sock_fd;
-			throw s.c_str();
+		const char socketpath[] = "/tmp/fastcgisocket",
+		int nWorkers = 1) {
+		if (running) return;
+		defaultRoute.setCallbacks(argGetCallback, argPostCallback);
+		// the lookup structures are only built once
+		router.build(routes);
+		inFlight = std::make_shared<std::atomic<int>>(0);
+		asyncResponses = std::make_shared<AsyncResponses>(inFlight);
+		if (Backend::NATIVE == backend) {
+			native.reset(new FastCGINativeServer);
+			native->start(socketpath);
+		} else {
+			// init the connection
+			FCGX_Init();
+			// open the socket
+			sock_fd = FCGX_OpenSocket(socketpath, 1024);
+			if (sock_fd < 0) {
+				std::string s = "Could not open socket. Error: "+sock_fd;
+				throw s.c_str();
+			}
 		}
 		// making sure the nginx process can read/write to it
 		chmod(socketpath, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
-		// init requests so that we can accept requests
-		FCGX_InitRequest(&request, sock_fd, 0);
-		// starting main loop
-		mainThread = std::thread(&JSONCGIHandler::exec, this);
+		if (nWorkers < 1) nWorkers = 1;
+		for(int i = 0; i < nWorkers; i++) {
+			workers.push_back(std::unique_ptr<Worker>(new Worker));
+		}
+		running = true;
+		// starting the worker loops
+		for(auto& w : workers) {
+			w->thread = std::thread(&JSONCGIHandler::exec, this, w.get());
+		}
+	}
+
+	/**
+	 * Limits the number of requests being processed at the same time,
+	 * including asynchronous ones which haven't been answered yet and,
+	 * with the native backend, those waiting for a worker.
+	 * Requests over the limit are answered straight away with
+	 * "503 Service Unavailable" and a Retry-After header.
+	 * Needs to be called before start().
+	 * \param n Max number of requests or 0 for no limit (default)
+	 **/
+	void setMaxInFlight(int n) {
+		maxInFlight = n;
+	}
+
+	/**
+	 * Rejects requests with "503 Service Unavailable" which have waited
+	 * longer than that for a worker. Only the native backend knows when
+	 * a request has arrived. Needs to be called before start().
+	 * \param ms Max waiting time in milliseconds or 0 for no limit (default)
+	 **/
+	void setMaxQueueWait(int ms) {
+		maxQueueWait = std::chrono::milliseconds(ms);
+	}
+
+	/**
+	 * Sets the Retry-After header of rejected requests.
+	 * \param seconds Time after which the client may try again (default 1)
+	 **/
+	void setRetryAfter(int seconds) {
+		retryAfter = seconds;
+	}
+
+	/**
+	 * Renders GET responses without a generation counter only once
+	 * for concurrent requests with the same path and query string.
+	 * The requests which arrive while it's being rendered get the same
+	 * bytes. The responses must then not depend on anything else, such
+	 * as headers, and are no longer streamed. Responses cached by
+	 * their generation are always rendered once per generation.
+	 * Needs to be called before start().
+	 * \param on true to share concurrent renderings (default false)
+	 **/
+	void setCoalescing(bool on) {
+		coalescing = on;
+	}
+
+	/**
+	 * Counts the requests by method and status code, the bytes
+	 * sent and received and records histograms of the time requests
+	 * wait for a worker, spend in the callbacks and take altogether.
+	 * They are served in the Prometheus text format at the given path
+	 * which bypasses the routes and the overload protection. The
+	 * wait for a worker is only known with the native backend.
+	 * Needs to be called before start().
+	 * \param path Path of the URL, for example "/metrics"
+	 **/
+	void setMetricsPath(const std::string& path) {
+		metricsPath = path;
+		if (!metrics) metrics = std::make_shared<JSONCGIMetrics>();
+	}
+
+#ifdef JSONCGI_TRACING
+	/**
+	 * Serves the most recent phases of the requests (accept, params,
+	 * route, callback, read, write, flush, finish) in the Chrome trace
+	 * event format at the given path which bypasses the routes and the
+	 * overload protection. Only there if JSONCGI_TRACING is defined.
+	 * Needs to be called before start().
+	 * \param path Path of the URL, for example "/trace"
+	 **/
+	void setTracePath(const std::string& path) {
+		tracePath = path;
+	}
+#endif
+
+	/**
+	 * Selects the implementation of the fastCGI protocol.
+	 * Needs to be called before start().
+	 * \param argBackend Backend::LIBFCGI (default) or Backend::NATIVE
+	 **/
+	void setBackend(Backend argBackend) {
+		backend = argBackend;
+	}
+
+	/**
+	 * Sets the max size of the POST data. Larger requests are
+	 * rejected with "413 Payload Too Large" without reading them.
+	 * It doesn't apply to a StreamingPOSTCallback.
+	 * Needs to be called before start().
+	 * \param bytes Max number of bytes (default 1MB)
+	 **/
+	void setMaxPostSize(size_t bytes) {
+		maxPostSize = bytes;
 	}
 
 	/**
 	 * Shuts down the connection to the webserver and
-	 * it also terminates the thread which is waiting for requests.
+	 * it also terminates the threads which are waiting for requests.
 	 **/
 	void stop() {
 		if (!running) return;
 		running = false;
-		shutdown(sock_fd, SHUT_RDWR);
-		FCGX_Free(&request, sock_fd);
-		mainThread.join();
+		if (native) {
+			// wakes up all waiting workers but keeps the connections
+			// open until the pending responses have been sent
+			native->stopAccepting();
+		} else {
+			// wakes up all workers blocking in FCGX_Accept_r()
+			shutdown(sock_fd, SHUT_RDWR);
+		}
+		for(auto& w : workers) {
+			w->thread.join();
+		}
+		workers.clear();
+		asyncResponses->stop();
+		for(auto& r : routes) {
+			r->stopEventStreams();
+		}
+		defaultRoute.stopEventStreams();
+		if (native) {
+			// closes the connections
+			native.reset();
+		} else {
+			close(sock_fd);
+		}
 	}
 
 	~JSONCGIHandler() {
 		stop();
 	}
 
+	/**
+	 * Creates the header of a GET response including the empty
+	 * line which separates it from the JSON data.
+	 * \param getCallback Provides the content type and max-age
+	 * \param etag Quoted ETag or an empty string for none
+	 * \return The header lines
+	 **/
+	static std::string getResponseHeader(GETCallback* getCallback, const std::string& etag) {
+		std::string buffer = "Content-type: " + getCallback->getContentType();
+		buffer = buffer + "; charset=utf-8\r\n";
+		buffer = buffer + cacheHeaders(getCallback, etag);
+		buffer = buffer + "\r\n";
+		return buffer;
+	}
+
+	/**
+	 * Gets the value of a parameter from a query string.
+	 * "+" and %-escapes are decoded.
+	 * \param queryString Query string, for example "since=1700000000000&n=5"
+	 * \param name Name of the parameter, for example "since"
+	 * \return The decoded value or an empty string if not present
+	 **/
+	static std::string getQueryParameter(const std::string& queryString, const std::string& name) {
+		size_t pos = 0;
+		while (pos <= queryString.length()) {
+			size_t end = queryString.find('&', pos);
+			if (end == std::string::npos) end = queryString.length();
+			const size_t eq = queryString.find('=', pos);
+			const size_t keyEnd = ((eq == std::string::npos) || (eq > end)) ? end : eq;
+			if ((keyEnd - pos == name.length()) &&
+			    (queryString.compare(pos, name.length(), name) == 0)) {
+				std::string value;
+				for(size_t i = keyEnd + 1; i < end; i++) {
+					const char c = queryString[i];
+					if (c == '+') {
+						value += ' ';
+					} else if ((c == '%') && (i + 2 < end) &&
+						   isxdigit(queryString[i+1]) && isxdigit(queryString[i+2])) {
+						value += (char)strtol(queryString.substr(i+1, 2).c_str(), nullptr, 16);
+						i += 2;
+					} else {
+						value += c;
+					}
+				}
+				return value;
+			}
+			pos = end + 1;
+		}
+		return "";
+	}
+
  private:
-	void exec() {
-		running = true;
-		while (running && (FCGX_Accept_r(&request) == 0)) {
-			char * method = FCGX_GetParam("REQUEST_METHOD", request.envp);
-			if (method == nullptr) {
-				fprintf(stderr,"Please add 'include fastcgi_params;' to the nginx conf.\n");
-				throw "JSONCGI parameters missing.\n";
-			}
-			if (strcmp(method, "GET") == 0) {
-				// create the header
-				std::string buffer = "Content-type: " + getCallback->getContentType();
-				buffer = buffer + "; charset=utf-8\r\n";
-				buffer = buffer + "\r\n";
-				// append the data
-				buffer = buffer + getCallback->getJSONString();
+	struct Route;
+	struct Flight;
+
+	/**
+	 * Request accepted by libfcgi. Every worker reuses its
+	 * own one unless it's handed over to another thread.
+	 **/
+	class FCGXExchange : public FastCGIExchange {
+	public:
+		FCGXExchange(int sock_fd) {
+			// set it to zero
+			memset(&request, 0, sizeof(FCGX_Request));
+			// init requests so that we can accept requests
+			FCGX_InitRequest(&request, sock_fd, 0);
+		}
+		~FCGXExchange() {
+			finish();
+			FCGX_Free(&request, 1);
+		}
+		/**
+		 * Waits for the next request on the socket.
+		 * \return false if the socket has been shut down
+		 **/
+		bool accept() {
+			JSONCGI_TRACE("accept");
+			finished = false;
+			return FCGX_Accept_r(&request) == 0;
+		}
+		char** getEnvp() override { return request.envp; }
+		int read(char* data, size_t length) override {
+			JSONCGI_TRACE("read");
+			const int n = FCGX_GetStr(data, (int)length, request.in);
+			return (n < 0) ? 0 : n;
+		}
+		bool write(const char* data, size_t length) override {
+			JSONCGI_TRACE("write");
+			return FCGX_PutStr(data, (int)length, request.out) >= 0;
+		}
+		bool flush() override {
+			JSONCGI_TRACE("flush");
+			return FCGX_FFlush(request.out) >= 0;
+		}
+		void finish() override {
+			if (finished) return;
+			JSONCGI_TRACE("finish");
+			finished = true;
+			FCGX_Finish_r(&request);
+		}
+	private:
+		FCGX_Request request;
+		bool finished = true;
+	};
+
+	/**
+	 * Counts the bytes of a request and takes the status code from
+	 * its response. It's added to the metrics when it's finished.
+	 **/
+	class MeteredExchange : public FastCGIExchange {
+	public:
+		MeteredExchange(const std::shared_ptr<JSONCGIMetrics>& argMetrics,
+				std::unique_ptr<FastCGIExchange> argExchange,
+				JSONCGIMetrics::Method argMethod) :
+			metrics(argMetrics), exchange(std::move(argExchange)), method(argMethod),
+			arrival(exchange->getArrivalTime()) {}
+		~MeteredExchange() {
+			finish();
+		}
+		char** getEnvp() override { return exchange->getEnvp(); }
+		int read(char* data, size_t length) override {
+			const int n = exchange->read(data, length);
+			bytesIn += n;
+			return n;
+		}
+		bool write(const char* data, size_t length) override {
+			if (0 == bytesOut) status = JSONCGIMetrics::getStatus(data, length);
+			bytesOut += length;
+			return exchange->write(data, length);
+		}
+		bool flush() override {
+			return exchange->flush();
+		}
+		void finish() override {
+			if (finished || !exchange) return;
+			finished = true;
+			exchange->finish();
+			metrics->addRequest(method, status, bytesIn, bytesOut);
+			if (timed) metrics->addResponseTime(std::chrono::steady_clock::now() - arrival);
+		}
+		std::chrono::steady_clock::time_point getArrivalTime() override {
+			return arrival;
+		}
+		/**
+		 * Hands back the request of the backend after it has been finished.
+		 **/
+		std::unique_ptr<FastCGIExchange> release() {
+			return std::move(exchange);
+		}
+		// event streams are open for a long time and aren't timed
+		bool timed = true;
+	private:
+		std::shared_ptr<JSONCGIMetrics> metrics;
+		std::unique_ptr<FastCGIExchange> exchange;
+		const JSONCGIMetrics::Method method;
+		const std::chrono::steady_clock::time_point arrival;
+		int status = 200;
+		uint64_t bytesIn = 0;
+		uint64_t bytesOut = 0;
+		bool finished = false;
+	};
+
+	/**
+	 * Every worker takes requests from the backend
+	 * and serves them one after the other.
+	 **/
+	struct Worker {
+		// libfcgi request structure for the next request
+		std::unique_ptr<FCGXExchange> fcgx;
+		std::thread thread;
+		// receives the POST data and keeps its size
+		std::vector<char> postBuffer;
+		// the request which is being served
+		Request current;
+	};
+
+	/**
+	 * Waits for the next request.
+	 * \return The request or nullptr if the handler has been stopped
+	 **/
+	std::unique_ptr<FastCGIExchange> accept(Worker& worker) {
+		if (native) return native->next();
+		if (!worker.fcgx) worker.fcgx.reset(new FCGXExchange(sock_fd));
+		if (!worker.fcgx->accept()) return nullptr;
+		return std::move(worker.fcgx);
+	}
+
+	void exec(Worker* worker) {
+		while (running) {
+			std::unique_ptr<FastCGIExchange> exchange = accept(*worker);
+			if (!exchange) break;
+			inFlight->fetch_add(1);
+			if (metrics) {
+				metrics->addAcceptWait(std::chrono::steady_clock::now() - exchange->getArrivalTime());
+			}
+			process(exchange, *worker);
+			// it's gone if it's now served by an event stream or a responder
+			if (!exchange) continue;
+			exchange->finish();
+			inFlight->fetch_sub(1);
+			if (!native) {
+				if (metrics) exchange = static_cast<MeteredExchange&>(*exchange).release();
+				worker->fcgx.reset(static_cast<FCGXExchange*>(exchange.release()));
+			}
+		}
+	}
+
+	/**
+	 * Serves one request of either backend.
+	 **/
+	void process(std::unique_ptr<FastCGIExchange>& exchange, Worker& worker) {
+		JSONCGI_TRACE("request");
+		Request& current = worker.current;
+		current.index(exchange->getEnvp());
+		const std::string_view method = current.getParam("REQUEST_METHOD");
+		if (method.empty()) {
+			fprintf(stderr,"Please add 'include fastcgi_params;' to the nginx conf.\n");
+			throw "JSONCGI parameters missing.\n";
+		}
+		if (metrics) {
+			exchange.reset(new MeteredExchange(metrics, std::move(exchange),
+							   JSONCGIMetrics::getMethod(method)));
+		}
+		Route* route = findRoute(current);
+		if (metrics && (current.getPath() == metricsPath)) {
+			sendMetrics(*exchange, method);
+#ifdef JSONCGI_TRACING
+		} else if (!tracePath.empty() && (current.getPath() == tracePath)) {
+			sendTrace(*exchange, method);
+#endif
+		} else if (nullptr == route) {
+			sendStatus(*exchange, "404 Not Found");
+		} else if ((method != "POST") && overloaded(*route, *exchange)) {
+			const std::string buffer = "Status: 503 Service Unavailable\r\nRetry-After: " +
+				std::to_string(retryAfter) + "\r\n\r\n";
+			exchange->write(buffer.c_str(), buffer.length());
+		} else if (method == "GET") {
+			GETCallback* getCallback = route->getCallback;
+			if (nullptr == getCallback) {
+				sendStatus(*exchange, "405 Method Not Allowed");
+				return;
+			}
+			Generation* generation = getCallback->getGeneration();
+			if ((nullptr != generation) && (nullptr == route->asyncGetCallback) &&
+			    (current.getHeader("Accept").find("text/event-stream") != std::string_view::npos)) {
+				// the request is now served by the event stream thread
+				startEventStream(*route, std::move(exchange), *generation);
+				return;
+			}
+			const std::string etag = getCallback->getETag();
+			if (etagMatches(current.getHeader("If-None-Match"), etag)) {
+				// the browser has already got it
+				std::string buffer = "Status: 304 Not Modified\r\n";
+				buffer = buffer + cacheHeaders(getCallback, etag);
 				buffer = buffer + "\r\n";
-				// send the data to the web server
-				FCGX_PutStr(buffer.c_str(), buffer.length(), request.out);
-				FCGX_Finish_r(&request);
-			}
-			if ( (nullptr != postCallback) && (strcmp(method, "POST") == 0) ) {
-			    long reqLen = 1;
-			    char * content_length_str = FCGX_GetParam("CONTENT_LENGTH",
-								      request.envp);
-			    if (content_length_str) reqLen = atol(content_length_str)+1;
-			    char* tmp = new char[reqLen];
-			    FCGX_GetStr(tmp,reqLen,request.in);
-			    tmp[reqLen - 1] = 0;
-			    if (nullptr != postCallback) {
-				postCallback->postString(tmp);
-			    }
-			    delete[] tmp;
-			    // create the header
-			    std::string buffer = "Content-type: text/html";
-			    buffer = buffer + "; charset=utf-8\r\n";
-			    buffer = buffer + "\r\n";
-			    // append the data
-			    buffer = buffer + "\r\n";
-			    buffer = buffer + "<html></html>\r\n";
-			    // send the data to the web server
-			    FCGX_PutStr(buffer.c_str(), buffer.length(), request.out);
-			    FCGX_Finish_r(&request);
+				exchange->write(buffer.c_str(), buffer.length());
+			} else if (nullptr != route->asyncGetCallback) {
+				// the request is now answered by the responder
+				startAsyncResponse(*route, std::move(exchange), current, etag);
+			} else if ((nullptr != generation) && current.queryString.empty() &&
+				   current.pathParameters.empty()) {
+				const std::shared_ptr<const std::string> buffer =
+					getCachedGETResponse(*route, *generation);
+				exchange->write(buffer->c_str(), buffer->length());
+			} else if (coalescing) {
+				std::string key(current.getPath());
+				key += '?';
+				key += current.getQueryString();
+				const std::shared_ptr<const std::string> buffer =
+					coalesce(*route, key, [this, getCallback, &current]() {
+						StringResponseWriter writer;
+						writeGETResponse(writer, getCallback, current);
+						return std::move(writer.buffer);
+					});
+				exchange->write(buffer->c_str(), buffer->length());
+			} else {
+				ExchangeResponseWriter writer(*exchange);
+				writeGETResponse(writer, getCallback, current);
+			}
+		} else if (method == "POST") {
+			if (nullptr == route->postCallback) {
+				sendStatus(*exchange, "405 Method Not Allowed");
+			} else if (nullptr != route->streamingPostCallback) {
+				receivePOSTStream(*exchange, worker, *route);
+			} else {
+				receivePOST(*exchange, worker, *route);
 			}
+		} else {
+			sendStatus(*exchange, "405 Method Not Allowed");
 		}
 	}
 
+	/**
+	 * Checks if a request needs to be rejected because too many
+	 * are in flight or it has waited too long. The limits are
+	 * halved for routes with low priority.
+	 **/
+	bool overloaded(const Route& route, FastCGIExchange& exchange) const {
+		if (Priority::HIGH == route.priority) return false;
+		const int divisor = (Priority::LOW == route.priority) ? 2 : 1;
+		if (maxInFlight > 0) {
+			const int limit = std::max(1, maxInFlight / divisor);
+			// including this one and those waiting for a worker
+			size_t n = (size_t)inFlight->load();
+			if (native) n += native->getQueueLength();
+			if (n > (size_t)limit) return true;
+		}
+		if (maxQueueWait.count() > 0) {
+			const auto waited = std::chrono::steady_clock::now() - exchange.getArrivalTime();
+			if (waited > maxQueueWait / divisor) return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Finds the route of a request and fills in its path,
+	 * query string and path parameters.
+	 * \return The route or nullptr if none matches
+	 **/
+	Route* findRoute(Request& r) {
+		JSONCGI_TRACE("route");
+		r.queryString = r.getParam("QUERY_STRING");
+		r.path = r.getParam("DOCUMENT_URI");
+		if (r.path.empty()) {
+			r.pathBuffer = r.getParam("SCRIPT_NAME");
+			r.pathBuffer += r.getParam("PATH_INFO");
+			r.path = r.pathBuffer;
+		}
+		Route* route = router.find(r.path, r.pathParameters);
+		if (nullptr != route) return route;
+		if ((nullptr == defaultRoute.getCallback) && (nullptr == defaultRoute.postCallback)) {
+			return nullptr;
+		}
+		return &defaultRoute;
+	}
+
+	/**
+	 * Sends a reply without a body.
+	 * \param status Status code and text, for example "404 Not Found"
+	 **/
+	static void sendStatus(FastCGIExchange& exchange, const char* status) {
+		const std::string buffer = std::string("Status: ") + status + "\r\n\r\n";
+		exchange.write(buffer.c_str(), buffer.length());
+	}
+
+	/**
+	 * Sends the metrics in the Prometheus text format.
+	 **/
+	void sendMetrics(FastCGIExchange& exchange, std::string_view method) {
+		if (method != "GET") {
+			sendStatus(exchange, "405 Method Not Allowed");
+			return;
+		}
+		std::string buffer = "Content-type: text/plain; version=0.0.4; charset=utf-8\r\n";
+		buffer = buffer + "Cache-Control: no-cache\r\n";
+		buffer = buffer + "\r\n";
+		buffer = buffer + metrics->getPrometheusText(inFlight->load());
+		exchange.write(buffer.c_str(), buffer.length());
+	}
+
+#ifdef JSONCGI_TRACING
+	/**
+	 * Sends the recorded phases in the Chrome trace event format.
+	 **/
+	static void sendTrace(FastCGIExchange& exchange, std::string_view method) {
+		if (method != "GET") {
+			sendStatus(exchange, "405 Method Not Allowed");
+			return;
+		}
+		std::string buffer = "Content-type: application/json; charset=utf-8\r\n";
+		buffer = buffer + "Cache-Control: no-cache\r\n";
+		buffer = buffer + "\r\n";
+		buffer = buffer + JSONCGITrace::get().getChromeJSON();
+		exchange.write(buffer.c_str(), buffer.length());
+	}
+#endif
+
+	/**
+	 * Calls f() and records the time it has taken if there are metrics.
+	 **/
+	template<typename F>
+	void timeCallback(F f) {
+		JSONCGI_TRACE("callback");
+		if (!metrics) {
+			f();
+			return;
+		}
+		const auto start = std::chrono::steady_clock::now();
+		f();
+		metrics->addCallbackTime(std::chrono::steady_clock::now() - start);
+	}
+
+	/**
+	 * \return The CONTENT_LENGTH, 0 if there is none, -1 if it's
+	 *         not a number of bytes or LONG_MAX if it's too large
+	 **/
+	static long getContentLength(const Request& r) {
+		const std::string_view s = r.getParam("CONTENT_LENGTH");
+		if (s.empty()) return 0;
+		if (!isdigit((unsigned char)s[0])) return -1;
+		long length = 0;
+		const auto result = std::from_chars(s.data(), s.data() + s.length(), length);
+		if (result.ptr != s.data() + s.length()) return -1;
+		if (std::errc::result_out_of_range == result.ec) return LONG_MAX;
+		return length;
+	}
+
+	/**
+	 * Rejects a POST request with the reason as JSON: {"error":"..."}
+	 * \param status Status code and text, for example "400 Bad Request"
+	 * \param message Reason which doesn't need to be escaped
+	 **/
+	static void sendPOSTError(FastCGIExchange& exchange, const char* status, const char* message) {
+		std::string buffer = std::string("Status: ") + status + "\r\n";
+		buffer = buffer + "Content-type: application/json; charset=utf-8\r\n";
+		buffer = buffer + "\r\n";
+		buffer = buffer + "{\"error\":\"" + message + "\"}";
+		exchange.write(buffer.c_str(), buffer.length());
+	}
+
+	/**
+	 * Receives the POST data into the worker's buffer
+	 * and passes it on to the callback in one go.
+	 **/
+	void receivePOST(FastCGIExchange& exchange, Worker& worker, Route& route) {
+		const long length = getContentLength(worker.current);
+		if (length < 0) {
+			sendPOSTError(exchange, "400 Bad Request", "Invalid CONTENT_LENGTH.");
+			return;
+		}
+		if ((size_t)length > maxPostSize) {
+			sendPOSTError(exchange, "413 Payload Too Large", "POST data too large.");
+			return;
+		}
+		// grows only until the largest request has been seen
+		std::vector<char>& body = worker.postBuffer;
+		if (body.size() < (size_t)length + 1) body.resize(length + 1);
+		size_t received = 0;
+		while (received < (size_t)length) {
+			const int n = exchange.read(body.data() + received, length - received);
+			if (n <= 0) break;
+			received += n;
+		}
+		body[received] = 0;
+		timeCallback([&]() {
+			route.postCallback->postString(worker.current, body.data(), received);
+		});
+		// create the header
+		std::string buffer = "Content-type: text/html";
+		buffer = buffer + "; charset=utf-8\r\n";
+		buffer = buffer + "\r\n";
+		// append the data
+		buffer = buffer + "\r\n";
+		buffer = buffer + "<html></html>\r\n";
+		// send the data to the web server
+		exchange.write(buffer.c_str(), buffer.length());
+	}
+
+	/**
+	 * Passes the POST data on to the receiver of a streaming
+	 * callback in pieces of the size of the worker's buffer.
+	 **/
+	void receivePOSTStream(FastCGIExchange& exchange, Worker& worker, Route& route) {
+		const long l = getContentLength(worker.current);
+		if (l < 0) {
+			sendPOSTError(exchange, "400 Bad Request", "Invalid CONTENT_LENGTH.");
+			return;
+		}
+		const size_t length = (size_t)l;
+		std::unique_ptr<StreamingPOSTCallback::Receiver> receiver;
+		bool ok = false;
+		// the time includes the reads as the data is passed on while it arrives
+		timeCallback([&]() {
+			receiver = route.streamingPostCallback->postBegin(worker.current, length);
+			ok = (nullptr != receiver);
+			std::vector<char>& chunk = worker.postBuffer;
+			if (chunk.size() < postChunkSize) chunk.resize(postChunkSize);
+			size_t received = 0;
+			while (ok && (received < length)) {
+				const size_t n = std::min(length - received, chunk.size());
+				const int r = exchange.read(chunk.data(), n);
+				if (r <= 0) break;
+				received += r;
+				ok = receiver->postChunk(chunk.data(), r);
+			}
+			if (ok) ok = receiver->postEnd();
+		});
+		if (!ok) {
+			// the rest of the data is discarded by the backend
+			sendStatus(exchange, "400 Bad Request");
+			return;
+		}
+		std::string buffer = "Content-type: " + receiver->getContentType();
+		buffer = buffer + "; charset=utf-8\r\n";
+		buffer = buffer + "\r\n";
+		buffer = buffer + receiver->getResponseString();
+		buffer = buffer + "\r\n";
+		exchange.write(buffer.c_str(), buffer.length());
+	}
+
+	/**
+	 * Passes the response straight on to the request. The
+	 * backend buffers it and sends it on in records.
+	 **/
+	class ExchangeResponseWriter : public ResponseWriter {
+	public:
+		ExchangeResponseWriter(FastCGIExchange& argExchange) : exchange(argExchange) {}
+		using ResponseWriter::write;
+		bool write(const char* data, size_t length) override {
+			return exchange.write(data, length);
+		}
+	private:
+		FastCGIExchange& exchange;
+	};
+
+	/**
+	 * Collects the response in a string for the cache.
+	 **/
+	class StringResponseWriter : public ResponseWriter {
+	public:
+		using ResponseWriter::write;
+		bool write(const char* data, size_t length) override {
+			buffer.append(data, length);
+			return true;
+		}
+		std::string buffer;
+	};
+
+	/**
+	 * Writes the header once and then the JSON data
+	 * from the callback as it's produced.
+	 **/
+	void writeGETResponse(ResponseWriter& writer, GETCallback* getCallback, const Request& request) {
+		// the tag is obtained before the data so that it's never newer than the data
+		const std::string etag = getCallback->getETag();
+		writer.write(getResponseHeader(getCallback, etag));
+		// append the data
+		timeCallback([&]() {
+			getCallback->writeJSONString(writer, request);
+		});
+		writer.write("\r\n", 2);
+	}
+
+	/**
+	 * Creates the header and appends the JSON data from the callback.
+	 **/
+	std::string renderGETResponse(Route& route) {
+		StringResponseWriter writer;
+		writeGETResponse(writer, route.getCallback, Request(route.path, ""));
+		return writer.buffer;
+	}
+
+	/**
+	 * ETag and Cache-Control header lines. Without a max-age but with
+	 * an ETag the browser is asked to always revalidate.
+	 **/
+	static std::string cacheHeaders(GETCallback* getCallback, const std::string& etag) {
+		std::string buffer;
+		if (!etag.empty()) {
+			buffer = "ETag: " + etag + "\r\n";
+		}
+		const int maxAge = getCallback->getMaxAge();
+		if (maxAge >= 0) {
+			buffer = buffer + "Cache-Control: max-age=" + std::to_string(maxAge) + "\r\n";
+		} else if (!etag.empty()) {
+			buffer = buffer + "Cache-Control: no-cache\r\n";
+		}
+		return buffer;
+	}
+
+	/**
+	 * Checks if one of the tags in the If-None-Match header
+	 * matches the current ETag. Weak tags (W/) compare equal
+	 * to strong ones as required for If-None-Match.
+	 * \param ifNoneMatch Content of the If-None-Match header or an empty view
+	 * \param etag Current quoted ETag
+	 **/
+	static bool etagMatches(std::string_view ifNoneMatch, const std::string& etag) {
+		if (ifNoneMatch.empty() || etag.empty()) return false;
+		size_t pos = 0;
+		while (pos < ifNoneMatch.length()) {
+			const char c = ifNoneMatch[pos];
+			if ((c == ' ') || (c == '\t') || (c == ',')) {
+				pos++;
+				continue;
+			}
+			if (c == '*') return true;
+			if (ifNoneMatch.compare(pos, 2, "W/") == 0) pos += 2;
+			size_t end = ifNoneMatch.find(',', pos);
+			if (end == std::string_view::npos) end = ifNoneMatch.length();
+			size_t last = end;
+			while ((last > pos) && ((ifNoneMatch[last-1] == ' ') || (ifNoneMatch[last-1] == '\t'))) last--;
+			if (ifNoneMatch.substr(pos, last - pos) == etag) return true;
+			pos = end;
+		}
+		return false;
+	}
+
+	/**
+	 * Returns the cached response or renders a new one if the
+	 * generation of the data has moved on. The generation is read
+	 * before rendering so that a change while rendering invalidates
+	 * the new entry straight away.
+	 **/
+	std::shared_ptr<const std::string> getCachedGETResponse(Route& route, const Generation& generation) {
+		ResponseCache& cache = route.cache;
+		const uint64_t g = generation.get();
+		{
+			std::lock_guard<std::mutex> lock(cache.mutex);
+			if (cache.response && (cache.generation == g)) {
+				return cache.response;
+			}
+		}
+		// concurrent misses of the same generation share one rendering
+		std::shared_ptr<const std::string> response =
+			coalesce(route, "#" + std::to_string(g), [this, &route]() { return renderGETResponse(route); });
+		std::lock_guard<std::mutex> lock(cache.mutex);
+		// a slower rendering of an older generation mustn't replace a newer one
+		if (!cache.response || (g >= cache.generation)) {
+			cache.generation = g;
+			cache.response = response;
+		}
+		return response;
+	}
+
+	/**
+	 * Renders a response only once for concurrent requests with the
+	 * same key. The first one renders it and the others wait for it
+	 * and share the bytes.
+	 * \param route The route of the requests
+	 * \param key Identifies identical requests of the route
+	 * \param render Returns the response with header
+	 * \return The response
+	 **/
+	template<typename Render>
+	std::shared_ptr<const std::string> coalesce(Route& route, const std::string& key, Render render) {
+		std::shared_ptr<Flight> flight;
+		bool leader = false;
+		{
+			std::lock_guard<std::mutex> lock(route.flightsMutex);
+			std::shared_ptr<Flight>& f = route.flights[key];
+			if (!f) {
+				f = std::make_shared<Flight>();
+				leader = true;
+			}
+			flight = f;
+		}
+		if (!leader) {
+			std::unique_lock<std::mutex> lock(flight->mutex);
+			flight->done.wait(lock, [&flight]() { return flight->finished; });
+			if (flight->response) return flight->response;
+			// the rendering has failed so it's tried again
+			return std::make_shared<const std::string>(render());
+		}
+		std::shared_ptr<const std::string> response;
+		try {
+			response = std::make_shared<const std::string>(render());
+		} catch (...) {
+			landFlight(route, key, *flight, nullptr);
+			throw;
+		}
+		landFlight(route, key, *flight, response);
+		return response;
+	}
+
+	/**
+	 * Hands over the response to the waiting requests. Requests
+	 * arriving from now on start a new rendering.
+	 **/
+	static void landFlight(Route& route, const std::string& key, Flight& flight,
+			       const std::shared_ptr<const std::string>& response) {
+		{
+			std::lock_guard<std::mutex> lock(route.flightsMutex);
+			route.flights.erase(key);
+		}
+		{
+			std::lock_guard<std::mutex> lock(flight.mutex);
+			flight.response = response;
+			flight.finished = true;
+		}
+		flight.done.notify_all();
+	}
+
+	/**
+	 * Formats the data as a server-sent event. Every line of
+	 * the data needs its own "data:" field.
+	 **/
+	static std::string formatEvent(uint64_t id, const std::string& data) {
+		std::string event = "id: " + std::to_string(id) + "\n";
+		size_t pos = 0;
+		while (pos < data.length()) {
+			size_t end = data.find('\n', pos);
+			if (end == std::string::npos) end = data.length();
+			event = event + "data: " + data.substr(pos, end - pos) + "\n";
+			pos = end + 1;
+		}
+		event = event + "\n";
+		return event;
+	}
+
+	/**
+	 * Keeps the server-sent event streams open and pushes an
+	 * event to all of them whenever the generation of the data
+	 * has changed. A single thread serves all streams so that
+	 * they don't block the workers.
+	 **/
+	class EventStreams {
+	public:
+		EventStreams(GETCallback* argGetCallback, Generation* argGeneration) :
+			getCallback(argGetCallback), generation(argGeneration) {}
+
+		void start() {
+			running = true;
+			thread = std::thread(&EventStreams::run, this);
+		}
+
+		void add(std::unique_ptr<FastCGIExchange> exchange) {
+			std::lock_guard<std::mutex> lock(mutex);
+			streams.push_back(std::move(exchange));
+		}
+
+		void stop() {
+			running = false;
+			generation->notifyAll();
+			thread.join();
+			// finishes the requests
+			streams.clear();
+		}
+
+	private:
+		void run() {
+			uint64_t sent = generation->get();
+			while (running) {
+				const bool changed = generation->waitForChange(sent, keepAliveMs);
+				if (!running) break;
+				// a comment keeps idle connections open
+				std::string event = ": keep alive\n\n";
+				if (changed) {
+					sent = generation->get();
+					event = formatEvent(sent, getCallback->getEventString());
+				}
+				std::lock_guard<std::mutex> lock(mutex);
+				for(auto it = streams.begin(); it != streams.end();) {
+					FastCGIExchange* r = it->get();
+					if (!r->write(event.c_str(), event.length()) || !r->flush()) {
+						// the browser has gone
+						it = streams.erase(it);
+					} else {
+						it++;
+					}
+				}
+			}
+		}
+
+		static const int keepAliveMs = 15000;
+		GETCallback* getCallback;
+		Generation* generation;
+		std::atomic<bool> running{false};
+		std::thread thread;
+		std::mutex mutex;
+		std::vector<std::unique_ptr<FastCGIExchange>> streams;
+	};
+
+	/**
+	 * Sends the header and the current data as the first event
+	 * and then hands over the request to the event stream thread.
+	 **/
+	void startEventStream(Route& route, std::unique_ptr<FastCGIExchange> exchange, Generation& generation) {
+		// streams are open for a long time and don't count
+		inFlight->fetch_sub(1);
+		if (metrics) static_cast<MeteredExchange&>(*exchange).timed = false;
+		GETCallback* getCallback = route.getCallback;
+		std::string buffer = "Content-type: text/event-stream; charset=utf-8\r\n";
+		buffer = buffer + "Cache-Control: no-cache\r\n";
+		// tells nginx not to buffer the events
+		buffer = buffer + "X-Accel-Buffering: no\r\n";
+		buffer = buffer + "\r\n";
+		buffer = buffer + formatEvent(generation.get(), getCallback->getEventString());
+		if (!exchange->write(buffer.c_str(), buffer.length()) || !exchange->flush()) {
+			// finishes the request
+			return;
+		}
+		std::lock_guard<std::mutex> lock(route.eventStreamsMutex);
+		if (!route.eventStreams) {
+			route.eventStreams.reset(new EventStreams(getCallback, &generation));
+			route.eventStreams->start();
+		}
+		route.eventStreams->add(std::move(exchange));
+	}
+
+	/**
+	 * Requests of AsyncGETCallbacks which haven't been answered yet.
+	 * It's shared with the responders so that they can outlive the handler.
+	 **/
+	struct AsyncResponses {
+		AsyncResponses(const std::shared_ptr<std::atomic<int>>& argInFlight) : inFlight(argInFlight) {}
+		// requests of the handler which are being processed
+		std::shared_ptr<std::atomic<int>> inFlight;
+		std::mutex mutex;
+		std::condition_variable idle;
+		std::unordered_set<Responder*> pending;
+		// replies which are being sent right now
+		int busy = 0;
+
+		/**
+		 * Answers all pending requests with "503 Service Unavailable".
+		 * Responders called afterwards do nothing.
+		 **/
+		void stop() {
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait(lock, [this]() { return 0 == busy; });
+			for(Responder* r : pending) {
+				sendStatus(*(r->exchange), "503 Service Unavailable");
+				r->exchange.reset();
+				inFlight->fetch_sub(1);
+			}
+			pending.clear();
+		}
+	};
+
+	/**
+	 * Hands over the request to a responder and passes it on to the callback.
+	 **/
+	void startAsyncResponse(Route& route, std::unique_ptr<FastCGIExchange> exchange,
+				const Request& request, const std::string& etag) {
+		const std::string header = getResponseHeader(route.getCallback, etag);
+		std::shared_ptr<Responder> responder(new Responder(asyncResponses, std::move(exchange), header));
+		{
+			std::lock_guard<std::mutex> lock(asyncResponses->mutex);
+			asyncResponses->pending.insert(responder.get());
+		}
+		timeCallback([&]() {
+			route.asyncGetCallback->getJSONStringAsync(std::move(responder), request);
+		});
+	}
+
+	/**
+	 * Rendered GET response with header
+	 * and the generation of the data it was rendered from.
+	 **/
+	struct ResponseCache {
+		std::mutex mutex;
+		uint64_t generation = 0;
+		std::shared_ptr<const std::string> response;
+	};
+
+	/**
+	 * A rendering which identical requests are waiting for.
+	 **/
+	struct Flight {
+		std::mutex mutex;
+		std::condition_variable done;
+		bool finished = false;
+		// nullptr if it has failed
+		std::shared_ptr<const std::string> response;
+	};
+
+	/**
+	 * The callbacks of a path and the state which belongs to them.
+	 **/
+	struct Route {
+		std::string path;
+		// names of the ':' segments in the order of the path
+		std::vector<std::string> parameterNames;
+		GETCallback* getCallback = nullptr;
+		POSTCallback* postCallback = nullptr;
+		StreamingPOSTCallback* streamingPostCallback = nullptr;
+		AsyncGETCallback* asyncGetCallback = nullptr;
+		Priority priority = Priority::NORMAL;
+		ResponseCache cache;
+		// renderings in progress by path and query
+		std::mutex flightsMutex;
+		std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+		std::mutex eventStreamsMutex;
+		std::unique_ptr<EventStreams> eventStreams;
+
+		void setCallbacks(GETCallback* argGetCallback, POSTCallback* argPostCallback) {
+			getCallback = argGetCallback;
+			asyncGetCallback = dynamic_cast<AsyncGETCallback*>(argGetCallback);
+			postCallback = argPostCallback;
+			streamingPostCallback = dynamic_cast<StreamingPOSTCallback*>(argPostCallback);
+		}
+
+		void stopEventStreams() {
+			std::lock_guard<std::mutex> lock(eventStreamsMutex);
+			if (eventStreams) {
+				eventStreams->stop();
+				eventStreams.reset();
+			}
+		}
+	};
+
+	/**
+	 * Finds the route of a path. Routes without parameters are
+	 * found with one hash lookup and the others by walking a trie
+	 * of path segments so that the time it takes doesn't depend
+	 * on the number of routes.
+	 **/
+	class Router {
+	public:
+		/**
+		 * Adds a leading and removes a trailing '/' so that
+		 * "sensor/" and "/sensor" are the same path.
+		 **/
+		static std::string normalise(const std::string& path) {
+			std::string p = path;
+			if (p.empty() || (p[0] != '/')) p = "/" + p;
+			while ((p.length() > 1) && (p.back() == '/')) p.pop_back();
+			return p;
+		}
+
+		/**
+		 * The tables refer to the paths of the routes
+		 * which must not change afterwards.
+		 **/
+		void build(const std::vector<std::unique_ptr<Route>>& routes) {
+			exact.clear();
+			root.reset();
+			for(const auto& r : routes) {
+				const std::string_view path = r->path;
+				if (path.find("/:") == std::string_view::npos) {
+					exact[path] = r.get();
+					continue;
+				}
+				if (!root) root.reset(new Node);
+				r->parameterNames.clear();
+				Node* node = root.get();
+				size_t pos = 1;
+				while (pos <= path.length()) {
+					size_t end = path.find('/', pos);
+					if (end == std::string_view::npos) end = path.length();
+					const std::string_view segment = path.substr(pos, end - pos);
+					if (!segment.empty() && (segment[0] == ':')) {
+						r->parameterNames.push_back(std::string(segment.substr(1)));
+						if (!node->parameter) node->parameter.reset(new Node);
+						node = node->parameter.get();
+					} else {
+						std::unique_ptr<Node>& child = node->children[segment];
+						if (!child) child.reset(new Node);
+						node = child.get();
+					}
+					pos = end + 1;
+				}
+				node->route = r.get();
+			}
+		}
+
+		/**
+		 * Finds the route without copying the path.
+		 * \param path Path of the request
+		 * \param parameters Receives the names and values of the ':' segments
+		 * \return The route or nullptr if none matches
+		 **/
+		Route* find(std::string_view path,
+			    std::vector<std::pair<std::string_view, std::string_view>>& parameters) const {
+			if (exact.empty() && !root) return nullptr;
+			while ((path.length() > 1) && (path.back() == '/')) path.remove_suffix(1);
+			if (path.empty() || (path[0] != '/')) return nullptr;
+			const auto it = exact.find(path);
+			if (it != exact.end()) return it->second;
+			if (!root) return nullptr;
+			const Node* node = match(root.get(), path, 1, parameters);
+			if (nullptr == node) return nullptr;
+			for(size_t i = 0; i < parameters.size(); i++) {
+				parameters[i].first = node->route->parameterNames[i];
+			}
+			return node->route;
+		}
+
+	private:
+		struct Node {
+			std::unordered_map<std::string_view, std::unique_ptr<Node>> children;
+			// any segment
+			std::unique_ptr<Node> parameter;
+			Route* route = nullptr;
+		};
+
+		/**
+		 * Matches the segments from pos on. Fixed segments
+		 * take precedence over parameters.
+		 **/
+		static const Node* match(const Node* node, std::string_view path, size_t pos,
+					 std::vector<std::pair<std::string_view, std::string_view>>& values) {
+			if (pos > path.length()) {
+				return (nullptr != node->route) ? node : nullptr;
+			}
+			size_t end = path.find('/', pos);
+			if (end == std::string_view::npos) end = path.length();
+			const std::string_view segment = path.substr(pos, end - pos);
+			const auto it = node->children.find(segment);
+			if (it != node->children.end()) {
+				const Node* n = match(it->second.get(), path, end + 1, values);
+				if (nullptr != n) return n;
+			}
+			if (node->parameter && !segment.empty()) {
+				values.emplace_back(std::string_view(), segment);
+				const Node* n = match(node->parameter.get(), path, end + 1, values);
+				if (nullptr != n) return n;
+				values.pop_back();
+			}
+			return nullptr;
+		}
+
+		std::unordered_map<std::string_view, Route*> exact;
+		std::unique_ptr<Node> root;
+	};
+
  private:
-	FCGX_Request request;
+	// size of the pieces passed on to a StreamingPOSTCallback
+	static const size_t postChunkSize = 16384;
+	size_t maxPostSize = 1024 * 1024;
+	std::vector<std::unique_ptr<Route>> routes;
+	// requests which match no route
+	Route defaultRoute;
+	Router router;
+	std::vector<std::unique_ptr<Worker>> workers;
+	Backend backend = Backend::LIBFCGI;
+	std::unique_ptr<FastCGINativeServer> native;
+	std::shared_ptr<AsyncResponses> asyncResponses;
+	// admission control
+	std::shared_ptr<std::atomic<int>> inFlight;
+	int maxInFlight = 0;
+	std::chrono::steady_clock::duration maxQueueWait{0};
+	int retryAfter = 1;
+	bool coalescing = false;
+	std::shared_ptr<JSONCGIMetrics> metrics;
+	std::string metricsPath;
+#ifdef JSONCGI_TRACING
+	std::string tracePath;
+#endif
 	int sock_fd = 0;
-	bool running = false;
-	std::thread mainThread;
-	GETCallback* getCallback = nullptr;
-	POSTCallback* postCallback = nullptr;
+	std::atomic<bool> running{false};
 };
 
 #endif
@@ -0,0 +1,472 @@
+#ifndef JSON_SAX_PARSER_H
+#define JSON_SAX_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <charconv>
+#include <string>
+#include <vector>
+
+/**
+ * Incremental event driven JSON parser. The JSON text can be fed
+ * in pieces of any size, for example as they arrive from the
+ * network, and the handler is called for every element as soon as
+ * it's complete. Nothing but the current token and the nesting
+ * of objects and arrays is kept in memory:
+ *
+ *     class Calibration : public JSONSAXParser::Handler {
+ *         void number(double v) override { table.push_back(v); }
+ *     };
+ *     Calibration calibration;
+ *     JSONSAXParser parser(calibration);
+ *     parser.feed(chunk, length);  // repeatedly
+ *     parser.finish();
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+class JSONSAXParser {
+public:
+	/**
+	 * Receives the parser events. All methods do nothing by default
+	 * so only the ones needed have to be overloaded. Strings are
+	 * unescaped and in UTF-8. They're only valid during the call.
+	 **/
+	class Handler {
+	public:
+		virtual ~Handler() = default;
+		virtual void startObject() {}
+		virtual void endObject() {}
+		virtual void startArray() {}
+		virtual void endArray() {}
+		/**
+		 * Key of the next value in an object.
+		 **/
+		virtual void key(const char* s, size_t length) { (void)s; (void)length; }
+		virtual void string(const char* s, size_t length) { (void)s; (void)length; }
+		/**
+		 * A number. By default it's converted to a double and
+		 * passed on to number(double). The conversion doesn't
+		 * depend on the locale.
+		 * \param text The number as it appears in the JSON
+		 * \param length Length of the text
+		 **/
+		virtual void number(const char* text, size_t length) {
+			double v = 0;
+			if (std::from_chars(text, text + length, v).ec == std::errc::result_out_of_range) {
+				// too small if the exponent or the integer part says so
+				const char* e = (const char*)memchr(text, 'e', length);
+				if (nullptr == e) e = (const char*)memchr(text, 'E', length);
+				const char* digits = (text[0] == '-') ? text + 1 : text;
+				const bool tiny = ((nullptr != e) && (e[1] == '-')) || (digits[0] == '0');
+				v = tiny ? 0.0 : HUGE_VAL;
+				if (text[0] == '-') v = -v;
+			}
+			number(v);
+		}
+		virtual void number(double v) { (void)v; }
+		virtual void boolean(bool v) { (void)v; }
+		virtual void null() {}
+	};
+
+	/**
+	 * \param argHandler Receives the events
+	 * \param argMaxTokenLength Max length of a string or number in bytes
+	 * \param argMaxDepth Max nesting of objects and arrays
+	 **/
+	JSONSAXParser(Handler& argHandler,
+		      size_t argMaxTokenLength = 1024 * 1024,
+		      size_t argMaxDepth = 256) :
+		handler(argHandler),
+		maxTokenLength(argMaxTokenLength),
+		maxDepth(argMaxDepth) {
+		reset();
+	}
+
+	/**
+	 * Starts parsing a new document.
+	 **/
+	void reset() {
+		state = VALUE;
+		stack.clear();
+		token.clear();
+		error = nullptr;
+		offset = 0;
+		done = false;
+		highSurrogate = 0;
+	}
+
+	/**
+	 * Parses the next piece of JSON.
+	 * \param data Pointer to the JSON text
+	 * \param length Number of bytes
+	 * \return false if there's an error in the JSON
+	 **/
+	bool feed(const char* data, size_t length) {
+		for(size_t i = 0; (i < length) && (nullptr == error); i++) {
+			parse(data[i]);
+			// stays at the character which caused the error
+			if (nullptr == error) offset++;
+		}
+		return nullptr == error;
+	}
+
+	/**
+	 * Signals the end of the JSON text.
+	 * \return false if there's an error or the JSON is incomplete
+	 **/
+	bool finish() {
+		if (nullptr != error) return false;
+		if (state == NUMBER) {
+			if (!endNumber()) return false;
+		}
+		if (!done) return fail("Unexpected end of JSON.");
+		return true;
+	}
+
+	/**
+	 * \return Description of the error or nullptr if there's none
+	 **/
+	const char* getError() const { return error; }
+
+	/**
+	 * \return Position of the error in bytes from the start
+	 **/
+	size_t getErrorOffset() const { return offset; }
+
+private:
+	enum State {
+		// a value is expected
+		VALUE,
+		// a value or "]" after "["
+		VALUE_OR_END,
+		// a key or "}" after "{"
+		KEY_OR_END,
+		// a key after ","
+		KEY,
+		// ":" after a key
+		COLON,
+		// "," or the end of the object or array after a value
+		AFTER_VALUE,
+		STRING,
+		STRING_ESCAPE,
+		STRING_UNICODE,
+		NUMBER,
+		LITERAL
+	};
+
+	static bool isSpace(char c) {
+		return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+	}
+
+	bool fail(const char* message) {
+		error = message;
+		return false;
+	}
+
+	bool append(char c) {
+		if (token.size() >= maxTokenLength) return fail("Token too long.");
+		token += c;
+		return true;
+	}
+
+	/**
+	 * A value has been completed.
+	 **/
+	void valueDone() {
+		if (stack.empty()) {
+			done = true;
+		}
+		state = AFTER_VALUE;
+	}
+
+	void parse(char c) {
+		switch (state) {
+		case STRING:
+			if ((0 != highSurrogate) && (c != '\\')) {
+				fail("Invalid surrogate pair in string.");
+			} else if (c == '"') {
+				endString();
+			} else if (c == '\\') {
+				state = STRING_ESCAPE;
+			} else if ((unsigned char)c < 0x20) {
+				fail("Control character in string.");
+			} else {
+				append(c);
+			}
+			return;
+		case STRING_ESCAPE:
+			escape(c);
+			return;
+		case STRING_UNICODE:
+			unicode(c);
+			return;
+		case NUMBER:
+			if (((c >= '0') && (c <= '9')) || (c == '.') || (c == 'e') ||
+			    (c == 'E') || (c == '+') || (c == '-')) {
+				append(c);
+				return;
+			}
+			if (!endNumber()) return;
+			// the character after the number is parsed as usual
+			break;
+		case LITERAL:
+			literal(c);
+			return;
+		default:
+			break;
+		}
+		if (isSpace(c)) return;
+		switch (state) {
+		case VALUE_OR_END:
+			if (c == ']') {
+				endContainer('[');
+				return;
+			}
+			startValue(c);
+			return;
+		case VALUE:
+			startValue(c);
+			return;
+		case KEY_OR_END:
+			if (c == '}') {
+				endContainer('{');
+				return;
+			}
+			// fall through
+		case KEY:
+			if (c != '"') {
+				fail("Expected a key.");
+				return;
+			}
+			startString(true);
+			return;
+		case COLON:
+			if (c != ':') {
+				fail("Expected ':'.");
+				return;
+			}
+			state = VALUE;
+			return;
+		case AFTER_VALUE:
+			if (stack.empty()) {
+				fail("Unexpected character after the JSON value.");
+			} else if (c == ',') {
+				state = (stack.back() == '{') ? KEY : VALUE;
+			} else if ((c == '}') || (c == ']')) {
+				endContainer(c == '}' ? '{' : '[');
+			} else {
+				fail("Expected ',' or the end of the object or array.");
+			}
+			return;
+		default:
+			return;
+		}
+	}
+
+	void startValue(char c) {
+		if (done) {
+			fail("Unexpected character after the JSON value.");
+			return;
+		}
+		if ((c == '{') || (c == '[')) {
+			if (stack.size() >= maxDepth) {
+				fail("Nested too deeply.");
+				return;
+			}
+			stack.push_back(c);
+			if (c == '{') {
+				handler.startObject();
+				state = KEY_OR_END;
+			} else {
+				handler.startArray();
+				state = VALUE_OR_END;
+			}
+		} else if (c == '"') {
+			startString(false);
+		} else if ((c == '-') || ((c >= '0') && (c <= '9'))) {
+			token.clear();
+			token += c;
+			state = NUMBER;
+		} else if ((c == 't') || (c == 'f') || (c == 'n')) {
+			token.clear();
+			token += c;
+			literalText = (c == 't') ? "true" : ((c == 'f') ? "false" : "null");
+			state = LITERAL;
+		} else {
+			fail("Unexpected character.");
+		}
+	}
+
+	void endContainer(char open) {
+		if (stack.empty() || (stack.back() != open)) {
+			fail("Mismatched brackets.");
+			return;
+		}
+		stack.pop_back();
+		if (open == '{') {
+			handler.endObject();
+		} else {
+			handler.endArray();
+		}
+		valueDone();
+	}
+
+	void startString(bool argIsKey) {
+		token.clear();
+		isKey = argIsKey;
+		highSurrogate = 0;
+		state = STRING;
+	}
+
+	void endString() {
+		if (isKey) {
+			handler.key(token.data(), token.size());
+			state = COLON;
+		} else {
+			handler.string(token.data(), token.size());
+			valueDone();
+		}
+	}
+
+	void escape(char c) {
+		state = STRING;
+		if ((0 != highSurrogate) && (c != 'u')) {
+			fail("Invalid surrogate pair in string.");
+			return;
+		}
+		switch (c) {
+		case '"': append('"'); break;
+		case '\\': append('\\'); break;
+		case '/': append('/'); break;
+		case 'b': append('\b'); break;
+		case 'f': append('\f'); break;
+		case 'n': append('\n'); break;
+		case 'r': append('\r'); break;
+		case 't': append('\t'); break;
+		case 'u':
+			codeUnit = 0;
+			nHexDigits = 0;
+			state = STRING_UNICODE;
+			break;
+		default:
+			fail("Invalid escape in string.");
+		}
+	}
+
+	void unicode(char c) {
+		int digit;
+		if ((c >= '0') && (c <= '9')) digit = c - '0';
+		else if ((c >= 'a') && (c <= 'f')) digit = c - 'a' + 10;
+		else if ((c >= 'A') && (c <= 'F')) digit = c - 'A' + 10;
+		else {
+			fail("Invalid \\u escape in string.");
+			return;
+		}
+		codeUnit = (codeUnit << 4) | (uint32_t)digit;
+		if (++nHexDigits < 4) return;
+		state = STRING;
+		const bool low = (codeUnit >= 0xDC00) && (codeUnit < 0xE000);
+		if ((0 != highSurrogate) != low) {
+			// a high surrogate without a low one or the other way round
+			fail("Invalid surrogate pair in string.");
+			return;
+		}
+		if ((codeUnit >= 0xD800) && (codeUnit < 0xDC00)) {
+			// first half of a surrogate pair, the second one follows
+			highSurrogate = codeUnit;
+			return;
+		}
+		uint32_t cp = codeUnit;
+		if (low) {
+			cp = 0x10000 + ((highSurrogate - 0xD800) << 10) + (codeUnit - 0xDC00);
+		}
+		highSurrogate = 0;
+		// UTF-8
+		if (cp < 0x80) {
+			append((char)cp);
+		} else if (cp < 0x800) {
+			append((char)(0xC0 | (cp >> 6)));
+			append((char)(0x80 | (cp & 0x3F)));
+		} else if (cp < 0x10000) {
+			append((char)(0xE0 | (cp >> 12)));
+			append((char)(0x80 | ((cp >> 6) & 0x3F)));
+			append((char)(0x80 | (cp & 0x3F)));
+		} else {
+			append((char)(0xF0 | (cp >> 18)));
+			append((char)(0x80 | ((cp >> 12) & 0x3F)));
+			append((char)(0x80 | ((cp >> 6) & 0x3F)));
+			append((char)(0x80 | (cp & 0x3F)));
+		}
+	}
+
+	/**
+	 * Checks the number against the JSON grammar
+	 * -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+	 **/
+	bool endNumber() {
+		const char* p = token.c_str();
+		if (*p == '-') p++;
+		if (*p == '0') {
+			p++;
+		} else if ((*p >= '1') && (*p <= '9')) {
+			while ((*p >= '0') && (*p <= '9')) p++;
+		} else {
+			return fail("Invalid number.");
+		}
+		if (*p == '.') {
+			p++;
+			if (!((*p >= '0') && (*p <= '9'))) return fail("Invalid number.");
+			while ((*p >= '0') && (*p <= '9')) p++;
+		}
+		if ((*p == 'e') || (*p == 'E')) {
+			p++;
+			if ((*p == '+') || (*p == '-')) p++;
+			if (!((*p >= '0') && (*p <= '9'))) return fail("Invalid number.");
+			while ((*p >= '0') && (*p <= '9')) p++;
+		}
+		if (*p != 0) return fail("Invalid number.");
+		handler.number(token.data(), token.size());
+		valueDone();
+		return true;
+	}
+
+	void literal(char c) {
+		if (c != literalText[token.size()]) {
+			fail("Invalid literal.");
+			return;
+		}
+		token += c;
+		if (literalText[token.size()] != 0) return;
+		if (token[0] == 't') {
+			handler.boolean(true);
+		} else if (token[0] == 'f') {
+			handler.boolean(false);
+		} else {
+			handler.null();
+		}
+		valueDone();
+	}
+
+	Handler& handler;
+	const size_t maxTokenLength;
+	const size_t maxDepth;
+	State state = VALUE;
+	// the open objects '{' and arrays '['
+	std::vector<char> stack;
+	// string, number or literal which is being parsed
+	std::string token;
+	bool isKey = false;
+	const char* literalText = nullptr;
+	uint32_t codeUnit = 0;
+	uint32_t highSurrogate = 0;
+	int nHexDigits = 0;
+	const char* error = nullptr;
+	size_t offset = 0;
+	bool done = false;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef JSON_SCHEMA_H
+#define JSON_SCHEMA_H
+
+#include <stddef.h>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+
+#include "json_writer.h"
+#include "json_fastcgi_web_api.h"
+
+/**
+ * Compile time JSON schemas for plain structs. The field names
+ * are turned into constant key strings (with quotes and colon) by
+ * the compiler and at runtime only the values are formatted:
+ *
+ *     struct SensorResponse {
+ *         long epoch;
+ *         float lastvalue;
+ *         std::vector<float> temperature;
+ *     };
+ *
+ *     JSON_SCHEMA(SensorResponse,
+ *                 JSON_FIELD(SensorResponse, epoch),
+ *                 JSON_FIELD(SensorResponse, lastvalue),
+ *                 JSON_FIELD(SensorResponse, temperature));
+ *
+ * Fields can be numbers, bools, strings, containers or spans of
+ * numbers, other structs with a schema or containers of them.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+
+/**
+ * Describes one member of a struct: the pointer to the member and
+ * its key already quoted and followed by a colon.
+ **/
+template<typename T, typename M>
+struct JSONField {
+	const char* key;
+	size_t keyLength;
+	M T::* member;
+};
+
+/**
+ * Creates a field descriptor. The length of the key is known at compile time.
+ **/
+template<typename T, typename M, size_t N>
+constexpr JSONField<T, M> makeJSONField(const char (&key)[N], M T::* member) {
+	return JSONField<T, M>{ key, N - 1, member };
+}
+
+/**
+ * Needs to be specialised for a struct with a tuple of
+ * JSONFields called "fields". Use JSON_SCHEMA for it.
+ **/
+template<typename T>
+struct JSONSchema;
+
+/**
+ * Field descriptor for the member "name" of the struct "Type"
+ * with the key "name".
+ **/
+#define JSON_FIELD(Type, name) makeJSONField("\"" #name "\":", &Type::name)
+
+/**
+ * Declares the schema of a struct. Needs to be used in the global namespace.
+ **/
+#define JSON_SCHEMA(Type, ...)						\
+	template<> struct JSONSchema<Type> {				\
+		static constexpr auto fields = std::make_tuple(__VA_ARGS__); \
+	}
+
+/**
+ * True if a JSONSchema has been declared for T.
+ **/
+template<typename T, typename = void>
+struct HasJSONSchema : std::false_type {};
+
+template<typename T>
+struct HasJSONSchema<T, decltype((void)JSONSchema<T>::fields)> : std::true_type {};
+
+/**
+ * True if T can be iterated over with begin() and end().
+ **/
+template<typename T, typename = void>
+struct IsJSONIterable : std::false_type {};
+
+template<typename T>
+struct IsJSONIterable<T, decltype((void)std::begin(std::declval<const T&>()),
+				  (void)std::end(std::declval<const T&>()))> : std::true_type {};
+
+/**
+ * Writes a value according to its type and, for structs, their schema.
+ * \param json The writer which receives the JSON
+ * \param v The value
+ **/
+template<typename T>
+void writeJSON(JSONWriter& json, const T& v) {
+	if constexpr (HasJSONSchema<T>::value) {
+		json.beginObject();
+		std::apply([&](const auto&... field) {
+			((json.rawKey(field.key, field.keyLength), writeJSON(json, v.*(field.member))), ...);
+		}, JSONSchema<T>::fields);
+		json.endObject();
+	} else if constexpr (std::is_arithmetic<T>::value ||
+			     std::is_convertible<T, std::string>::value) {
+		json.value(v);
+	} else if constexpr (IsJSONIterable<T>::value) {
+		using E = typename std::decay<decltype(*std::begin(v))>::type;
+		if constexpr (std::is_arithmetic<E>::value && !std::is_same<E, bool>::value) {
+			json.array(std::begin(v), std::end(v));
+		} else {
+			json.beginArray();
+			for(const auto& e : v) {
+				writeJSON(json, e);
+			}
+			json.endArray();
+		}
+	} else {
+		static_assert(HasJSONSchema<T>::value, "No JSON_SCHEMA declared for this type.");
+	}
+}
+
+/**
+ * GET callback which returns a struct with a JSON_SCHEMA instead of
+ * a string. The struct is serialised into a writer which keeps its
+ * memory from one request to the next.
+ **/
+template<typename Response>
+class TypedGETCallback : public JSONCGIHandler::GETCallback {
+public:
+	/**
+	 * Needs to return the data sent to the web browser.
+	 * \param request The path, query string and path parameters
+	 * \return The response struct
+	 **/
+	virtual Response getResponse(const JSONCGIHandler::Request& request) = 0;
+
+	std::string getJSONString() override {
+		return getJSONString(JSONCGIHandler::Request());
+	}
+
+	std::string getJSONString(const std::string& queryString) override {
+		return getJSONString(JSONCGIHandler::Request("", queryString));
+	}
+
+	std::string getJSONString(const JSONCGIHandler::Request& request) override {
+		static thread_local JSONWriter json;
+		json.clear();
+		writeJSON(json, getResponse(request));
+		return json.str();
+	}
+};
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <functional>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+/**
+ * Compact JSON serialiser which writes numbers and arrays of
+ * numbers straight into a reusable text buffer without building
+ * a tree of nodes first:
+ *
+ *     JSONWriter json;
+ *     json.beginObject();
+ *     json.key("temperature").array(values, n);
+ *     json.key("time").array(timestamps, n);
+ *     json.endObject();
+ *     send(json.str());
+ *
+ * Floating point numbers are written with the shortest text which
+ * reads back as the same number or with a fixed number of decimals.
+ * Commas between values are inserted automatically.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+class JSONWriter {
+public:
+	/**
+	 * \param reserve Initial capacity of the text buffer in bytes
+	 **/
+	JSONWriter(size_t reserve = 4096) {
+		buffer.reserve(reserve);
+		needsComma.reserve(16);
+	}
+
+	/**
+	 * Empties the buffer but keeps its memory for the next document.
+	 **/
+	void clear() {
+		buffer.clear();
+		needsComma.clear();
+		failed = false;
+	}
+
+	/**
+	 * Streams the text to an output whenever the buffer has grown
+	 * beyond a threshold so that the memory use stays constant no
+	 * matter how much is written. Call flush() at the end for the rest.
+	 * \param argOutput Receives the text, for example a lambda calling
+	 *        JSONCGIHandler::ResponseWriter::write()
+	 * \param threshold Size of the buffer in bytes which triggers sending
+	 **/
+	void setOutput(std::function<bool(const char*, size_t)> argOutput,
+		       size_t threshold = 65536) {
+		output = argOutput;
+		flushAt = threshold;
+	}
+
+	/**
+	 * Sends the text written so far to the output set with setOutput()
+	 * and empties the buffer. Open objects and arrays stay open. Once
+	 * the output has failed nothing is sent anymore until clear().
+	 * \return false if the output has failed
+	 **/
+	bool flush() {
+		if (!output) return true;
+		if (!failed) failed = !output(buffer.data(), buffer.size());
+		buffer.clear();
+		return !failed;
+	}
+
+	/**
+	 * Lets a long running serialisation stop early, for example
+	 * when the browser has gone away.
+	 * \return false if the output has failed
+	 **/
+	bool ok() const { return !failed; }
+
+	/**
+	 * \return The JSON text written so far
+	 **/
+	const std::string& str() const { return buffer; }
+
+	/**
+	 * \return Pointer to the JSON text written so far
+	 **/
+	const char* data() const { return buffer.data(); }
+
+	/**
+	 * \return Length of the JSON text written so far
+	 **/
+	size_t size() const { return buffer.size(); }
+
+	/**
+	 * Sets the number of decimals of floating point numbers.
+	 * More than 17 decimals are not meaningful for a double
+	 * and are limited to 17.
+	 * \param d Number of decimals or -1 for the shortest text
+	 *          which reads back as the same number (default)
+	 **/
+	void setDecimals(int d) { decimals = (d > maxDecimals) ? maxDecimals : d; }
+
+	JSONWriter& beginObject() {
+		separate();
+		buffer += '{';
+		needsComma.push_back(false);
+		return *this;
+	}
+
+	JSONWriter& endObject() {
+		buffer += '}';
+		needsComma.pop_back();
+		return *this;
+	}
+
+	JSONWriter& beginArray() {
+		separate();
+		buffer += '[';
+		needsComma.push_back(false);
+		return *this;
+	}
+
+	JSONWriter& endArray() {
+		buffer += ']';
+		needsComma.pop_back();
+		return *this;
+	}
+
+	/**
+	 * Writes the key of the next value in an object.
+	 * \param name Key which must not need escaping
+	 **/
+	JSONWriter& key(const char* name) {
+		separate();
+		buffer += '"';
+		buffer += name;
+		buffer += "\":";
+		// the value follows without a comma
+		needsComma.back() = false;
+		return *this;
+	}
+
+	/**
+	 * Writes the key of the next value which has already been
+	 * quoted and followed by a colon, for example "\"epoch\":".
+	 * \param quotedKey The key with quotes and colon
+	 * \param length Length of the quoted key
+	 **/
+	JSONWriter& rawKey(const char* quotedKey, size_t length) {
+		separate();
+		buffer.append(quotedKey, length);
+		needsComma.back() = false;
+		return *this;
+	}
+
+	JSONWriter& value(double v) {
+		separate();
+		writeDouble(v, false);
+		return *this;
+	}
+
+	JSONWriter& value(float v) {
+		separate();
+		writeDouble(v, true);
+		return *this;
+	}
+
+	JSONWriter& value(long long v) {
+		separate();
+		writeInt(v);
+		return *this;
+	}
+
+	JSONWriter& value(unsigned long long v) {
+		separate();
+		writeUInt(v);
+		return *this;
+	}
+
+	JSONWriter& value(int v) { return value((long long)v); }
+	JSONWriter& value(long v) { return value((long long)v); }
+	JSONWriter& value(unsigned v) { return value((unsigned long long)v); }
+	JSONWriter& value(unsigned long v) { return value((unsigned long long)v); }
+
+	JSONWriter& value(bool v) {
+		separate();
+		buffer += v ? "true" : "false";
+		return *this;
+	}
+
+	JSONWriter& value(const std::string& v) {
+		separate();
+		writeString(v.data(), v.length());
+		return *this;
+	}
+
+	JSONWriter& value(const char* v) {
+		separate();
+		writeString(v, strlen(v));
+		return *this;
+	}
+
+	/**
+	 * Writes null.
+	 **/
+	JSONWriter& null() {
+		separate();
+		buffer += "null";
+		return *this;
+	}
+
+	/**
+	 * Inserts already serialised JSON as the next value.
+	 **/
+	JSONWriter& raw(const char* json, size_t length) {
+		separate();
+		buffer.append(json, length);
+		return *this;
+	}
+
+	/**
+	 * Writes an array of numbers.
+	 * \param values Pointer to the numbers
+	 * \param n Number of values
+	 **/
+	template<typename T>
+	JSONWriter& array(const T* values, size_t n) {
+		return array(values, values + n);
+	}
+
+	/**
+	 * Writes an array of numbers from a range of iterators.
+	 **/
+	template<typename It>
+	JSONWriter& array(It begin, It end) {
+		separate();
+		buffer += '[';
+		for(It it = begin; it != end; ++it) {
+			if (it != begin) buffer += ',';
+			writeNumber(*it);
+			if ((buffer.size() >= flushAt) && !flush()) break;
+		}
+		buffer += ']';
+		return *this;
+	}
+
+	/**
+	 * Writes an array of numbers from a container with begin() and end().
+	 **/
+	template<typename C>
+	JSONWriter& array(const C& values) {
+		return array(values.begin(), values.end());
+	}
+
+private:
+	void separate() {
+		if (buffer.size() >= flushAt) flush();
+		if (needsComma.empty()) return;
+		if (needsComma.back()) buffer += ',';
+		needsComma.back() = true;
+	}
+
+	void writeNumber(float v) { writeDouble(v, true); }
+	void writeNumber(double v) { writeDouble(v, false); }
+	void writeNumber(int v) { writeInt(v); }
+	void writeNumber(long v) { writeInt(v); }
+	void writeNumber(long long v) { writeInt(v); }
+	void writeNumber(unsigned v) { writeUInt(v); }
+	void writeNumber(unsigned long v) { writeUInt(v); }
+	void writeNumber(unsigned long long v) { writeUInt(v); }
+
+	void writeInt(int64_t v) {
+		if (v < 0) buffer += '-';
+		// negating as unsigned also works for the most negative number
+		writeUInt((v < 0) ? (0 - (uint64_t)v) : (uint64_t)v);
+	}
+
+	void writeUInt(uint64_t u) {
+		char tmp[24];
+		char* p = tmp + sizeof(tmp);
+		while (u >= 100) {
+			const unsigned i = (unsigned)(u % 100) * 2;
+			u /= 100;
+			*--p = digitPairs()[i + 1];
+			*--p = digitPairs()[i];
+		}
+		if (u >= 10) {
+			const unsigned i = (unsigned)u * 2;
+			*--p = digitPairs()[i + 1];
+			*--p = digitPairs()[i];
+		} else {
+			*--p = (char)('0' + u);
+		}
+		buffer.append(p, tmp + sizeof(tmp) - p);
+	}
+
+	void writeDouble(double v, bool isFloat) {
+		if (!isfinite(v)) {
+			// JSON has no NaN or infinity
+			buffer += "null";
+			return;
+		}
+		if (decimals >= 0) {
+			writeFixed(v);
+		} else if (isFloat) {
+			writeShortest((float)v);
+		} else {
+			writeShortest(v);
+		}
+	}
+
+	/**
+	 * Fixed number of decimals. Scaled to an integer
+	 * if that can be done exactly.
+	 **/
+	void writeFixed(double v) {
+		static const double powers[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+		if ((decimals < 10) && (fabs(v) * powers[decimals] < 9e15)) {
+			const int64_t scaled = llround(v * powers[decimals]);
+			const uint64_t divider = (uint64_t)powers[decimals];
+			const uint64_t u = (scaled < 0) ? (0 - (uint64_t)scaled) : (uint64_t)scaled;
+			if (scaled < 0) buffer += '-';
+			writeUInt(u / divider);
+			if (decimals > 0) {
+				char frac[12];
+				uint64_t f = u % divider;
+				for(int i = decimals - 1; i >= 0; i--) {
+					frac[i] = (char)('0' + f % 10);
+					f /= 10;
+				}
+				buffer += '.';
+				buffer.append(frac, decimals);
+			}
+			return;
+		}
+		// DBL_MAX has 309 digits before the point
+		char tmp[350];
+		int n = snprintf(tmp, sizeof(tmp), "%.*f", decimals, v);
+		if (n < 0) n = 0;
+		if (n >= (int)sizeof(tmp)) n = sizeof(tmp) - 1;
+		buffer.append(tmp, n);
+	}
+
+	template<typename T>
+	void writeShortest(T v) {
+		char tmp[32];
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+		const std::to_chars_result r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+		buffer.append(tmp, r.ptr - tmp);
+#else
+		// the smallest precision which reads back as the same number
+		const int maxPrecision = (sizeof(T) == sizeof(float)) ? 9 : 17;
+		int n = 0;
+		for(int precision = 1; precision <= maxPrecision; precision++) {
+			n = snprintf(tmp, sizeof(tmp), "%.*g", precision, (double)v);
+			if ((T)strtod(tmp, nullptr) == v) break;
+		}
+		buffer.append(tmp, n);
+#endif
+	}
+
+	void writeString(const char* s, size_t length) {
+		static const char hex[] = "0123456789abcdef";
+		buffer += '"';
+		for(size_t i = 0; i < length; i++) {
+			const unsigned char c = (unsigned char)s[i];
+			if ((c == '"') || (c == '\\')) {
+				buffer += '\\';
+				buffer += (char)c;
+			} else if (c == '\n') {
+				buffer += "\\n";
+			} else if (c < 0x20) {
+				buffer += "\\u00";
+				buffer += hex[c >> 4];
+				buffer += hex[c & 15];
+			} else {
+				buffer += (char)c;
+			}
+		}
+		buffer += '"';
+	}
+
+	static const char* digitPairs() {
+		return
+			"00010203040506070809"
+			"10111213141516171819"
+			"20212223242526272829"
+			"30313233343536373839"
+			"40414243444546474849"
+			"50515253545556575859"
+			"60616263646566676869"
+			"70717273747576777879"
+			"80818283848586878889"
+			"90919293949596979899";
+	}
+
+	std::string buffer;
+	// one entry per open object or array
+	std::vector<bool> needsComma;
+	std::function<bool(const char*, size_t)> output;
+	// no streaming without an output
+	size_t flushAt = (size_t)-1;
+	// the output has failed
+	bool failed = false;
+	static constexpr int maxDecimals = 17;
+	int decimals = -1;
+};
+
+#endif
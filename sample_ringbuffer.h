@@ -0,0 +1,166 @@
+#ifndef SAMPLE_RINGBUFFER_H
+#define SAMPLE_RINGBUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <string.h>
+#include <type_traits>
+
+/**
+ * Fixed capacity ring buffer for timestamped samples with a single
+ * producer (for example a timer or sensor thread) and any number of
+ * reader threads (for example the fastCGI workers).
+ *
+ * The producer never blocks and never allocates. Readers take
+ * wait-free snapshots of the most recent samples: they copy the
+ * slots and then check which of them the producer might have
+ * overwritten in the meantime and drop those.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+template<typename T>
+class SampleRingBuffer {
+	static_assert(std::is_arithmetic<T>::value,
+		      "SampleRingBuffer needs an arithmetic value type.");
+public:
+	/**
+	 * A value together with its timestamp.
+	 **/
+	struct Sample {
+		int64_t time;
+		T value;
+	};
+
+	/**
+	 * Allocates the buffer once.
+	 * \param capacity Max number of samples kept
+	 **/
+	explicit SampleRingBuffer(size_t capacity) :
+		cap(capacity),
+		// one spare slot which the producer can write to
+		// while readers still see a full buffer
+		nSlots(capacity + 1),
+		slots(new Slot[capacity + 1]) {}
+
+	~SampleRingBuffer() {
+		delete[] slots;
+	}
+
+	SampleRingBuffer(const SampleRingBuffer&) = delete;
+	SampleRingBuffer& operator=(const SampleRingBuffer&) = delete;
+
+	/**
+	 * Adds a sample and overwrites the oldest one if the buffer is full.
+	 * Must only be called from one thread.
+	 * \param time Timestamp, for example in ms since the epoch
+	 * \param value The sample value
+	 **/
+	void push(int64_t time, T value) {
+		const uint64_t h = head.load(std::memory_order_relaxed);
+		Slot& slot = slots[h % nSlots];
+		// readers which see the new slot contents also see
+		// that the slot no longer holds sample h - nSlots
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.time.store(time, std::memory_order_relaxed);
+		slot.value.store(value, std::memory_order_relaxed);
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	/**
+	 * \return Max number of samples kept
+	 **/
+	size_t capacity() const { return cap; }
+
+	/**
+	 * \return Number of samples currently in the buffer
+	 **/
+	size_t size() const {
+		const uint64_t h = head.load(std::memory_order_acquire);
+		return (h < cap) ? (size_t)h : cap;
+	}
+
+	/**
+	 * \return Number of samples pushed since the buffer was created
+	 **/
+	uint64_t total() const {
+		return head.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Gets the most recent sample.
+	 * \param sample Receives the sample
+	 * \return false if the buffer is empty
+	 **/
+	bool latest(Sample& sample) const {
+		return snapshot(&sample, 1) == 1;
+	}
+
+	/**
+	 * Copies the most recent samples without blocking the producer.
+	 * \param dest Array which receives the samples, oldest first
+	 * \param maxSamples Max number of samples to copy
+	 * \return Number of samples copied
+	 **/
+	size_t snapshot(Sample* dest, size_t maxSamples) const {
+		const uint64_t h1 = head.load(std::memory_order_acquire);
+		uint64_t n = (h1 < cap) ? h1 : cap;
+		if (n > maxSamples) n = maxSamples;
+		const uint64_t first = h1 - n;
+		for(uint64_t i = 0; i < n; i++) {
+			const Slot& slot = slots[(first + i) % nSlots];
+			dest[i].time = slot.time.load(std::memory_order_relaxed);
+			dest[i].value = slot.value.load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t h2 = head.load(std::memory_order_relaxed);
+		// sample i is intact as long as sample i + nSlots hasn't been started
+		const uint64_t oldestIntact = (h2 < nSlots) ? 0 : h2 - nSlots + 1;
+		if (first >= oldestIntact) return n;
+		const uint64_t dropped = oldestIntact - first;
+		if (dropped >= n) return 0;
+		memmove(dest, dest + dropped, (n - dropped) * sizeof(Sample));
+		return n - dropped;
+	}
+
+	/**
+	 * Copies the most recent samples without blocking the producer.
+	 * \param maxSamples Max number of samples to copy
+	 * \return The samples, oldest first
+	 **/
+	std::vector<Sample> snapshot(size_t maxSamples = (size_t)-1) const {
+		std::vector<Sample> samples(maxSamples < cap ? maxSamples : cap);
+		samples.resize(snapshot(samples.data(), samples.size()));
+		return samples;
+	}
+
+	/**
+	 * Calls f(const Sample&) for a snapshot of the most
+	 * recent samples, oldest first.
+	 * \param f Function or lambda receiving the samples
+	 **/
+	template<typename F>
+	void forEach(F f) const {
+		for(const Sample& s : snapshot()) {
+			f(s);
+		}
+	}
+
+private:
+	struct Slot {
+		std::atomic<int64_t> time{0};
+		std::atomic<T> value{0};
+	};
+
+	const size_t cap;
+	const size_t nSlots;
+	Slot* const slots;
+	// written by the producer and polled by all readers so it
+	// gets a cache line on its own
+	alignas(64) std::atomic<uint64_t> head{0};
+	char padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+#endif
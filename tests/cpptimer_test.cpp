@@ -0,0 +1,113 @@
+/*
+ * Counts the calls of periodic CppTimers: every expiry results in
+ * a call, also when the timer thread wakes up late, unless it
+ * expires again while its timerEvent() is still running.
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * GNU GENERAL PUBLIC LICENSE Version 3
+ */
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "fake_sensor_demo/CppTimer.h"
+
+class CountingTimer : public CppTimer {
+public:
+	CountingTimer(std::chrono::microseconds argBusy = std::chrono::microseconds(0)) : busy(argBusy) {}
+	std::atomic<long> calls{0};
+	std::chrono::microseconds busy;
+	void timerEvent() override {
+		calls++;
+		if (busy.count() > 0) std::this_thread::sleep_for(busy);
+	}
+};
+
+static int failures = 0;
+
+static long expiriesSince(std::chrono::steady_clock::time_point start, long intervalNs) {
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+	return (long)(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / intervalNs);
+}
+
+/**
+ * Waits until the calls of the timers have caught up with the expiries
+ * so that a busy machine doesn't fail the test. Calls which have been
+ * lost never catch up.
+ * \return The number of expiries the calls have been compared with
+ **/
+static long catchUp(const std::vector<CountingTimer>& timers,
+		    std::chrono::steady_clock::time_point start, long intervalNs) {
+	long expiries = 0;
+	for(int i = 0; i < 100; i++) {
+		expiries = expiriesSince(start, intervalNs);
+		bool behind = false;
+		for(const auto& t : timers) {
+			if (t.calls < expiries - 1) behind = true;
+		}
+		if (!behind) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return expiries;
+}
+
+/**
+ * Runs timers for the duration and compares the number of calls
+ * with the number of expiries which have passed.
+ **/
+static void countExpiries(int n, long intervalNs, std::chrono::milliseconds duration) {
+	std::vector<CountingTimer> timers(n);
+	const auto start = std::chrono::steady_clock::now();
+	for(auto& t : timers) t.startns(intervalNs);
+	std::this_thread::sleep_for(duration);
+	const long expiries = catchUp(timers, start, intervalNs);
+	for(auto& t : timers) t.stop();
+	const long maxExpiries = expiriesSince(start, intervalNs);
+	for(const auto& t : timers) {
+		const long calls = t.calls;
+		if ((calls < expiries - 1) || (calls > maxExpiries)) {
+			fprintf(stderr, "FAILED: %d timers of %ld ns: %ld calls for %ld expiries\n",
+				n, intervalNs, calls, expiries);
+			failures++;
+			return;
+		}
+	}
+	printf("%d timers of %ld ns: %ld calls for %ld expiries\n",
+	       n, intervalNs, (long)timers[0].calls, expiries);
+}
+
+int main() {
+	countExpiries(1, 1000000, std::chrono::milliseconds(1000));
+	countExpiries(1, 500000, std::chrono::milliseconds(1000));
+	// several timers on the one timer thread
+	countExpiries(20, 1000000, std::chrono::milliseconds(500));
+
+	// the timer thread is blocked by another timer for 10 ms every 50 ms
+	{
+		CountingTimer blocking(std::chrono::microseconds(10000));
+		blocking.startms(50);
+		countExpiries(1, 1000000, std::chrono::milliseconds(1000));
+		blocking.stop();
+	}
+
+	// expiries during a slow timerEvent() result in one call
+	{
+		CountingTimer slow(std::chrono::microseconds(5000));
+		slow.startms(1);
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		slow.stop();
+		const long calls = slow.calls;
+		printf("slow timer: %ld calls in 200 ms\n", calls);
+		if ((calls < 20) || (calls > 45)) {
+			fprintf(stderr, "FAILED: slow timer\n");
+			failures++;
+		}
+	}
+
+	if (failures > 0) return 1;
+	printf("All checks passed.\n");
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Checks the FastCGINativeServer with a client which speaks the
+ * record protocol like nginx: a large response is multiplexed on one
+ * connection with a request which is aborted before it has started.
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "fastcgi_native.h"
+
+static void record(std::string& s, int type, int id, const std::string& content) {
+	s += (char)1;
+	s += (char)type;
+	s += (char)(id >> 8);
+	s += (char)(id & 0xff);
+	s += (char)(content.size() >> 8);
+	s += (char)(content.size() & 0xff);
+	s += (char)0;
+	s += (char)0;
+	s += content;
+}
+
+static std::string param(const std::string& name, const std::string& value) {
+	return (char)name.size() + ((char)value.size() + name + value);
+}
+
+static void beginRequest(std::string& s, int id) {
+	// responder, keep the connection
+	record(s, 1, id, std::string("\0\1\1\0\0\0\0\0", 8));
+}
+
+int main() {
+	// fails instead of hanging if the event loop gets stuck
+	alarm(20);
+	const char* path = "/tmp/fastcgi_native_test.sock";
+	unlink(path);
+	FastCGINativeServer server;
+	server.start(path);
+	const size_t responseLength = 4 * 1024 * 1024;
+	std::thread worker([&]() {
+		std::unique_ptr<FastCGIExchange> exchange;
+		while ((exchange = server.next())) {
+			const std::string data(responseLength, 'x');
+			exchange->write(data.data(), data.size());
+			exchange->finish();
+		}
+	});
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("connect");
+		return 1;
+	}
+	std::string s;
+	beginRequest(s, 1);
+	record(s, 4, 1, param("REQUEST_METHOD", "GET"));
+	record(s, 4, 1, "");
+	record(s, 5, 1, "");
+	if (write(fd, s.data(), s.size()) != (ssize_t)s.size()) return 1;
+	// the response fills the socket and the output queue
+	usleep(200000);
+	s.clear();
+	beginRequest(s, 2);
+	record(s, 4, 2, param("REQUEST_METHOD", "GET"));
+	record(s, 2, 2, "");
+	if (write(fd, s.data(), s.size()) != (ssize_t)s.size()) return 1;
+
+	// STDOUT bytes and END_REQUEST records per request
+	std::map<int, size_t> stdoutBytes;
+	std::map<int, int> ends;
+	std::string buffer;
+	char tmp[65536];
+	while ((ends[1] < 1) || (ends[2] < 1)) {
+		const ssize_t n = read(fd, tmp, sizeof(tmp));
+		if (n <= 0) break;
+		buffer.append(tmp, n);
+		while (buffer.size() >= 8) {
+			const unsigned char* h = (const unsigned char*)buffer.data();
+			const size_t length = ((size_t)h[4] << 8) | h[5];
+			const size_t total = 8 + length + h[6];
+			if (buffer.size() < total) break;
+			const int id = (h[2] << 8) | h[3];
+			if (6 == h[1]) stdoutBytes[id] += length;
+			if (3 == h[1]) ends[id]++;
+			buffer.erase(0, total);
+		}
+	}
+	close(fd);
+	server.stop();
+	worker.join();
+	unlink(path);
+
+	printf("request 1: %zu bytes, %d end; request 2: %zu bytes, %d end\n",
+	       stdoutBytes[1], ends[1], stdoutBytes[2], ends[2]);
+	if ((stdoutBytes[1] != responseLength) || (ends[1] != 1) ||
+	    (stdoutBytes[2] != 0) || (ends[2] != 1)) {
+		fprintf(stderr, "FAILED\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Runs a coroutine on the JSONCGIScheduler which sleeps and then
+ * waits for new data before it returns its JSON. Also checks
+ * that awaiting the scheduler outside of it is an error.
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <string>
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "json_fastcgi_coroutine.h"
+
+static JSONCGITask<std::string> getJSON(JSONCGIHandler::Generation& generation, uint64_t seen) {
+	co_await JSONCGIScheduler::sleepFor(std::chrono::milliseconds(50));
+	const uint64_t g = co_await JSONCGIScheduler::nextChange(generation, seen);
+	co_return "{\"generation\":" + std::to_string(g) + "}";
+}
+
+// stands in for the Responder of CoroGETCallback
+static JSONCGIScheduler::Detached respond(JSONCGITask<std::string> task,
+					  std::promise<std::string>& response) {
+	try {
+		response.set_value(co_await task);
+	} catch (...) {
+		response.set_value("500");
+	}
+}
+
+static JSONCGIScheduler::Detached sleepUnscheduled(bool& thrown) {
+	try {
+		co_await JSONCGIScheduler::sleepFor(std::chrono::milliseconds(1));
+	} catch (const char*) {
+		thrown = true;
+	}
+}
+
+int main() {
+	int failures = 0;
+
+	JSONCGIScheduler scheduler;
+	scheduler.start();
+	JSONCGIHandler::Generation generation;
+	std::promise<std::string> response;
+	std::future<std::string> result = response.get_future();
+	const auto t0 = std::chrono::steady_clock::now();
+	scheduler.spawn(respond(getJSON(generation, generation.get()), response));
+	// the coroutine is waiting for the change by now
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	if (std::future_status::ready == result.wait_for(std::chrono::seconds(0))) {
+		fprintf(stderr, "FAILED: responded before the data has changed\n");
+		failures++;
+	}
+	generation.bump();
+	if (std::future_status::ready != result.wait_for(std::chrono::seconds(5))) {
+		fprintf(stderr, "FAILED: no response after the data has changed\n");
+		return 1;
+	}
+	const std::string json = result.get();
+	if (json != "{\"generation\":2}") {
+		fprintf(stderr, "FAILED: %s\n", json.c_str());
+		failures++;
+	}
+	if (std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(200)) {
+		fprintf(stderr, "FAILED: responded too early\n");
+		failures++;
+	}
+	scheduler.stop();
+
+	// resumed on this thread instead of the scheduler
+	bool thrown = false;
+	JSONCGIScheduler::Detached d = sleepUnscheduled(thrown);
+	d.handle.resume();
+	if (!thrown) {
+		fprintf(stderr, "FAILED: sleepFor() outside of the scheduler\n");
+		failures++;
+	}
+
+	if (failures > 0) return 1;
+	printf("All checks passed.\n");
+	return 0;
+}
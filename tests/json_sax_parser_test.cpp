@@ -0,0 +1,127 @@
+/*
+ * Checks the JSONSAXParser with valid and invalid JSON fed in
+ * pieces of different sizes.
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <string>
+
+#include "json_sax_parser.h"
+
+/**
+ * Writes the events as text so that they can be compared.
+ **/
+class Recorder : public JSONSAXParser::Handler {
+public:
+	void startObject() override { events += "{"; }
+	void endObject() override { events += "}"; }
+	void startArray() override { events += "["; }
+	void endArray() override { events += "]"; }
+	void key(const char* s, size_t length) override { events += "k:" + std::string(s, length) + " "; }
+	void string(const char* s, size_t length) override { events += "s:" + std::string(s, length) + " "; }
+	void number(double v) override {
+		char tmp[32];
+		snprintf(tmp, sizeof(tmp), "n:%g ", v);
+		events += tmp;
+	}
+	void boolean(bool v) override { events += v ? "true " : "false "; }
+	void null() override { events += "null "; }
+	std::string events;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+	if (!ok) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/**
+ * Parses the JSON fed in pieces of the given size.
+ * \return true if it has been accepted
+ **/
+static bool parse(JSONSAXParser& parser, const std::string& json, size_t piece) {
+	parser.reset();
+	for(size_t i = 0; i < json.size(); i += piece) {
+		if (!parser.feed(json.data() + i, std::min(piece, json.size() - i))) return false;
+	}
+	return parser.finish();
+}
+
+static void accepts(const std::string& json, const std::string& events) {
+	for(size_t piece = 1; piece <= json.size(); piece++) {
+		Recorder recorder;
+		JSONSAXParser parser(recorder);
+		if (!(parse(parser, json, piece) && (recorder.events == events))) {
+			check(false, json.c_str());
+			return;
+		}
+	}
+}
+
+static void rejects(const std::string& json, const char* error) {
+	for(size_t piece = 1; piece <= json.size(); piece++) {
+		Recorder recorder;
+		JSONSAXParser parser(recorder);
+		if (parse(parser, json, piece) || (strcmp(parser.getError(), error) != 0)) {
+			check(false, json.c_str());
+			return;
+		}
+	}
+}
+
+int main() {
+	accepts("{\"a\":[1,-2.5e1,true,false,null],\"b\":{}}",
+		"{k:a [n:1 n:-25 true false null ]k:b {}}");
+	accepts("\"\\u00e9\\ud83d\\ude00\\n\"", "s:\xc3\xa9\xf0\x9f\x98\x80\n ");
+	accepts("[1e999,-1e999,1e-999]", "[n:inf n:-inf n:0 ]");
+
+	rejects("[1,]", "Unexpected character.");
+	rejects("01", "Invalid number.");
+	rejects("\"\\ud800\"", "Invalid surrogate pair in string.");
+	rejects("\"\\ud800x\"", "Invalid surrogate pair in string.");
+	rejects("\"\\ud800\\n\"", "Invalid surrogate pair in string.");
+	rejects("\"\\ud800\\ud800\"", "Invalid surrogate pair in string.");
+	rejects("\"\\udc00\"", "Invalid surrogate pair in string.");
+	// a high surrogate must not pair up with a low one of the next string
+	rejects("[\"a\\uD800b\",\"\\uDC00\"]", "Invalid surrogate pair in string.");
+
+	// nothing is carried over to the next document
+	{
+		Recorder recorder;
+		JSONSAXParser parser(recorder);
+		const char* unfinished = "\"\\ud800";
+		parser.feed(unfinished, strlen(unfinished));
+		parser.reset();
+		const char* low = "\"\\udc00\"";
+		check(!parser.feed(low, strlen(low)), "surrogate after reset()");
+	}
+
+	// the offset is the one of the character which caused the error
+	{
+		Recorder recorder;
+		JSONSAXParser parser(recorder);
+		const char* json = "[1,2,x]";
+		check(!parser.feed(json, strlen(json)), "error offset");
+		check(parser.getErrorOffset() == 5, "error offset");
+	}
+
+	// numbers don't depend on the decimal separator of the locale
+	if (nullptr != setlocale(LC_NUMERIC, "de_DE.UTF-8")) {
+		accepts("[2.5]", "[n:2,5 ]");
+	}
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed.\n");
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Checks the JSON which writeJSON() produces for structs
+ * declared with JSON_SCHEMA.
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "json_schema.h"
+#include "timeseries_store.h"
+
+struct Channel {
+	std::string name;
+	bool enabled;
+};
+
+JSON_SCHEMA(Channel,
+	    JSON_FIELD(Channel, name),
+	    JSON_FIELD(Channel, enabled));
+
+struct Response {
+	long epoch;
+	float lastvalue;
+	unsigned long count;
+	std::string unit;
+	bool valid;
+	std::vector<float> temperature;
+	std::vector<bool> flags;
+	std::vector<Channel> channels;
+	TimeSeriesSpan<int64_t> time;
+};
+
+JSON_SCHEMA(Response,
+	    JSON_FIELD(Response, epoch),
+	    JSON_FIELD(Response, lastvalue),
+	    JSON_FIELD(Response, count),
+	    JSON_FIELD(Response, unit),
+	    JSON_FIELD(Response, valid),
+	    JSON_FIELD(Response, temperature),
+	    JSON_FIELD(Response, flags),
+	    JSON_FIELD(Response, channels),
+	    JSON_FIELD(Response, time));
+
+class ResponseCallback : public TypedGETCallback<Response> {
+public:
+	Response getResponse(const JSONCGIHandler::Request& request) override {
+		(void)request;
+		Response r;
+		r.epoch = 1700000000000;
+		r.lastvalue = 21.5f;
+		r.count = 18446744073709551615UL;
+		r.unit = "\xc2\xb0" "C \"air\"";
+		r.valid = true;
+		r.temperature = { 20.25f, -1.5f, 0.1f };
+		r.flags = { true, false, true };
+		r.channels = { { "a", true }, { "b", false } };
+		r.time = store.all().getTime();
+		return r;
+	}
+	TimeSeriesStore<float> store{4};
+};
+
+int main() {
+	ResponseCallback callback;
+	callback.store.append(10, 1.0f);
+	callback.store.append(20, 2.0f);
+	const std::string expected =
+		"{\"epoch\":1700000000000,\"lastvalue\":21.5,\"count\":18446744073709551615,"
+		"\"unit\":\"\xc2\xb0" "C \\\"air\\\"\",\"valid\":true,"
+		"\"temperature\":[20.25,-1.5,0.1],\"flags\":[true,false,true],"
+		"\"channels\":[{\"name\":\"a\",\"enabled\":true},{\"name\":\"b\",\"enabled\":false}],"
+		"\"time\":[10,20]}";
+	int failures = 0;
+	// the writer is reused for the second request
+	for(int i = 0; i < 2; i++) {
+		const std::string json = callback.getJSONString();
+		if (json != expected) {
+			fprintf(stderr, "FAILED:\n%s\ninstead of\n%s\n", json.c_str(), expected.c_str());
+			failures++;
+		}
+	}
+	if (failures > 0) return 1;
+	printf("All checks passed.\n");
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Checks the text which the JSONWriter produces.
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <string>
+#include <vector>
+
+#include "json_writer.h"
+
+static int failures = 0;
+
+static void check(const std::string& json, const std::string& expected) {
+	if (json != expected) {
+		fprintf(stderr, "FAILED: %s instead of %s\n", json.c_str(), expected.c_str());
+		failures++;
+	}
+}
+
+int main() {
+	{
+		JSONWriter json;
+		json.beginArray();
+		json.value(0).value(-7).value(LLONG_MIN).value(LLONG_MAX);
+		json.endArray();
+		check(json.str(), "[0,-7,-9223372036854775808,9223372036854775807]");
+	}
+
+	{
+		JSONWriter json;
+		json.beginArray();
+		json.value(UINT_MAX).value(ULONG_MAX).value(ULLONG_MAX);
+		json.endArray();
+		check(json.str(), "[4294967295,18446744073709551615,18446744073709551615]");
+	}
+
+	{
+		const std::vector<unsigned long> u = { 0, 1, ULONG_MAX };
+		const std::vector<unsigned long long> ull = { ULLONG_MAX };
+		JSONWriter json;
+		json.beginObject();
+		json.key("u").array(u);
+		json.key("ull").array(ull);
+		json.endObject();
+		check(json.str(), "{\"u\":[0,1,18446744073709551615],\"ull\":[18446744073709551615]}");
+	}
+
+	{
+		const float f[] = { 0.1f, -2.5f, 1e30f };
+		JSONWriter json;
+		json.beginArray();
+		json.array(f, 3).value(1.0 / 0.0).value("a\"b\n").value(true).null();
+		json.endArray();
+		check(json.str(), "[[0.1,-2.5,1e+30],null,\"a\\\"b\\n\",true,null]");
+	}
+
+	{
+		JSONWriter json;
+		json.setDecimals(2);
+		json.beginArray();
+		json.value(-0.5).value(3.14159).value(1e20);
+		json.endArray();
+		check(json.str(), "[-0.50,3.14,100000000000000000000.00]");
+	}
+
+	// the decimals are limited to 17 so that the largest double fits
+	{
+		JSONWriter json;
+		json.setDecimals(40);
+		json.value(-DBL_MAX);
+		char expected[400];
+		snprintf(expected, sizeof(expected), "%.17f", -DBL_MAX);
+		check(json.str(), expected);
+	}
+
+	// nothing is sent anymore once the output has failed
+	{
+		const std::vector<int> values(10000, 12345);
+		int calls = 0;
+		std::string sent;
+		JSONWriter json;
+		json.setOutput([&](const char* data, size_t length) {
+			calls++;
+			sent.append(data, length);
+			return calls < 2;
+		}, 100);
+		json.beginArray();
+		json.array(values);
+		json.array(values);
+		json.endArray();
+		json.flush();
+		check(std::to_string(calls), "2");
+		check(json.ok() ? "ok" : "failed", "failed");
+		check(std::to_string(sent.size() < 300), "1");
+		json.clear();
+		check(json.ok() ? "ok" : "failed", "ok");
+	}
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed.\n");
+	return 0;
+}
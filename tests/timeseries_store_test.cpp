@@ -0,0 +1,64 @@
+/*
+ * Checks the TimeSeriesStore with one writer and several readers.
+ * Every slice which the store reports as intact must be consecutive
+ * and its values must belong to their timestamps.
+ *
+ * Copyright (c) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ */
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "timeseries_store.h"
+
+int main() {
+	const size_t capacity = 100;
+	const int nReaders = 4;
+	const long nSamples = 2000000;
+	TimeSeriesStore<float, int> store(capacity);
+	std::atomic<bool> writing{true};
+	std::atomic<long> intact{0};
+	std::atomic<long> broken{0};
+	std::vector<std::thread> readers;
+	for(int r = 0; r < nReaders; r++) {
+		readers.push_back(std::thread([&]() {
+			std::vector<int64_t> time;
+			std::vector<float> value;
+			std::vector<int> count;
+			while (writing) {
+				const auto slice = store.latest(capacity);
+				time.assign(slice.getTime().begin(), slice.getTime().end());
+				value.assign(slice.channel<0>().begin(), slice.channel<0>().end());
+				count.assign(slice.channel<1>().begin(), slice.channel<1>().end());
+				if (!store.intact(slice)) continue;
+				for(size_t i = 0; i < time.size(); i++) {
+					if ((value[i] != (float)(time[i] % 1000)) || (count[i] != (int)time[i]) ||
+					    ((i > 0) && (time[i] != time[i-1] + 1))) {
+						broken++;
+						break;
+					}
+				}
+				intact++;
+			}
+		}));
+	}
+	for(long i = 0; i < nSamples; i++) {
+		store.append(i, (float)(i % 1000), (int)i);
+	}
+	writing = false;
+	for(auto& t : readers) {
+		t.join();
+	}
+	const auto all = store.all();
+	const bool complete = (all.size() == capacity) && (all.getTime().back() == nSamples - 1) &&
+		(all.since(nSamples - 11).size() == 10);
+	printf("%ld intact slices, %ld broken\n", intact.load(), broken.load());
+	if ((broken > 0) || !complete) {
+		fprintf(stderr, "FAILED\n");
+		return 1;
+	}
+	return 0;
+}
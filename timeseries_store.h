@@ -0,0 +1,311 @@
+#ifndef TIMESERIES_STORE_H
+#define TIMESERIES_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+
+/**
+ * Read-only view of contiguous values in a TimeSeriesStore column.
+ * The values are atomics because the writer might overwrite them
+ * while they are read. They are loaded with relaxed ordering which
+ * costs the same as a plain load.
+ **/
+template<typename T>
+class TimeSeriesSpan {
+public:
+	/**
+	 * Random access iterator which returns the values by value.
+	 **/
+	class Iterator {
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = T;
+		using difference_type = ptrdiff_t;
+		using pointer = const T*;
+		using reference = T;
+		Iterator() = default;
+		explicit Iterator(const std::atomic<T>* argPtr) : p(argPtr) {}
+		T operator*() const { return p->load(std::memory_order_relaxed); }
+		T operator[](difference_type i) const { return p[i].load(std::memory_order_relaxed); }
+		Iterator& operator++() { ++p; return *this; }
+		Iterator operator++(int) { Iterator it = *this; ++p; return it; }
+		Iterator& operator--() { --p; return *this; }
+		Iterator operator--(int) { Iterator it = *this; --p; return it; }
+		Iterator& operator+=(difference_type i) { p += i; return *this; }
+		Iterator& operator-=(difference_type i) { p -= i; return *this; }
+		Iterator operator+(difference_type i) const { return Iterator(p + i); }
+		Iterator operator-(difference_type i) const { return Iterator(p - i); }
+		friend Iterator operator+(difference_type i, const Iterator& it) { return it + i; }
+		difference_type operator-(const Iterator& it) const { return p - it.p; }
+		bool operator==(const Iterator& it) const { return p == it.p; }
+		bool operator!=(const Iterator& it) const { return p != it.p; }
+		bool operator<(const Iterator& it) const { return p < it.p; }
+		bool operator>(const Iterator& it) const { return p > it.p; }
+		bool operator<=(const Iterator& it) const { return p <= it.p; }
+		bool operator>=(const Iterator& it) const { return p >= it.p; }
+	private:
+		const std::atomic<T>* p = nullptr;
+	};
+
+	TimeSeriesSpan() = default;
+	TimeSeriesSpan(const std::atomic<T>* argData, size_t argSize) : ptr(argData), n(argSize) {}
+	size_t size() const { return n; }
+	bool empty() const { return n == 0; }
+	Iterator begin() const { return Iterator(ptr); }
+	Iterator end() const { return Iterator(ptr + n); }
+	T operator[](size_t i) const { return ptr[i].load(std::memory_order_relaxed); }
+	T front() const { return (*this)[0]; }
+	T back() const { return (*this)[n - 1]; }
+	/**
+	 * \param offset Index of the first value
+	 * \param count Number of values
+	 * \return Part of this span
+	 **/
+	TimeSeriesSpan sub(size_t offset, size_t count) const {
+		if (offset > n) offset = n;
+		if (count > n - offset) count = n - offset;
+		return TimeSeriesSpan(ptr + offset, count);
+	}
+private:
+	const std::atomic<T>* ptr = nullptr;
+	size_t n = 0;
+};
+
+/**
+ * Bounded time series with one timestamp column and one column
+ * per channel (struct of arrays). For example a temperature and
+ * humidity sensor:
+ *
+ *     TimeSeriesStore<float,float> store(500);
+ *     store.append(t, temperature, humidity);
+ *
+ * Appending is O(1) and overwrites the oldest samples once the
+ * capacity has been reached. Every column is kept twice in a row
+ * so that any range of samples is contiguous in memory and can be
+ * handed out as spans without copying.
+ *
+ * Appending must be done by one thread only while any number of
+ * threads can read. Readers don't block the writer: they take a
+ * Slice, consume it and then check with intact() that the writer
+ * hasn't overwritten it in the meantime. If not, they read again.
+ *
+ * Copyright (C) 2026  Bernd Porr <mail@berndporr.me.uk>
+ * Apache License 2.0
+ **/
+template<typename... Channels>
+class TimeSeriesStore {
+	static_assert((std::is_trivially_copyable<Channels>::value && ...),
+		      "TimeSeriesStore needs trivially copyable channel types.");
+public:
+	/**
+	 * Type of the timestamps, for example ms since the epoch.
+	 **/
+	using Time = int64_t;
+
+	/**
+	 * Type of channel I.
+	 **/
+	template<size_t I>
+	using ChannelType = typename std::tuple_element<I, std::tuple<Channels...>>::type;
+
+	/**
+	 * Range of consecutive samples as contiguous spans.
+	 **/
+	class Slice {
+	public:
+		/**
+		 * \return Number of samples
+		 **/
+		size_t size() const { return time.size(); }
+		/**
+		 * \return true if there are no samples
+		 **/
+		bool empty() const { return time.empty(); }
+		/**
+		 * \return The timestamps
+		 **/
+		const TimeSeriesSpan<Time>& getTime() const { return time; }
+		/**
+		 * \return The values of channel I
+		 **/
+		template<size_t I>
+		const TimeSeriesSpan<ChannelType<I>>& channel() const {
+			return std::get<I>(channels);
+		}
+		/**
+		 * \param offset Index of the first sample
+		 * \param count Number of samples
+		 * \return Part of this slice
+		 **/
+		Slice sub(size_t offset, size_t count) const {
+			Slice s;
+			if (offset > size()) offset = size();
+			s.first = first + offset;
+			s.time = time.sub(offset, count);
+			s.channels = subChannels(offset, count, std::index_sequence_for<Channels...>());
+			return s;
+		}
+		/**
+		 * Binary search for the samples newer than a timestamp.
+		 * \param t Timestamp
+		 * \return The samples with timestamps > t
+		 **/
+		Slice since(Time t) const {
+			const size_t offset = std::upper_bound(time.begin(), time.end(), t) - time.begin();
+			return sub(offset, size() - offset);
+		}
+		/**
+		 * Binary search for the samples in a time range.
+		 * \param from Start timestamp (inclusive)
+		 * \param to End timestamp (exclusive)
+		 * \return The samples with from <= timestamp < to
+		 **/
+		Slice range(Time from, Time to) const {
+			const size_t a = std::lower_bound(time.begin(), time.end(), from) - time.begin();
+			const size_t b = std::lower_bound(time.begin() + a, time.end(), to) - time.begin();
+			return sub(a, b - a);
+		}
+	private:
+		friend class TimeSeriesStore;
+		template<size_t... I>
+		std::tuple<TimeSeriesSpan<Channels>...> subChannels(size_t offset, size_t count,
+								    std::index_sequence<I...>) const {
+			return std::make_tuple(std::get<I>(channels).sub(offset, count)...);
+		}
+		// sequence number of the first sample
+		uint64_t first = 0;
+		TimeSeriesSpan<Time> time;
+		std::tuple<TimeSeriesSpan<Channels>...> channels;
+	};
+
+	/**
+	 * Allocates all columns once.
+	 * \param capacity Max number of samples kept
+	 **/
+	explicit TimeSeriesStore(size_t capacity) :
+		cap(capacity),
+		// one spare row which the writer can fill while
+		// readers still see a full store
+		nRows(capacity + 1),
+		timeColumn(new std::atomic<Time>[2 * (capacity + 1)]()),
+		columns(std::unique_ptr<std::atomic<Channels>[]>(
+				new std::atomic<Channels>[2 * (capacity + 1)]())...) {}
+
+	TimeSeriesStore(const TimeSeriesStore&) = delete;
+	TimeSeriesStore& operator=(const TimeSeriesStore&) = delete;
+
+	/**
+	 * Appends a sample to all columns. Must only be called from one thread.
+	 * \param t Timestamp which must not be older than the previous one
+	 * \param values One value per channel
+	 **/
+	void append(Time t, Channels... values) {
+		const uint64_t h = head.load(std::memory_order_relaxed);
+		const size_t row = h % nRows;
+		// readers which see the new values also see that
+		// sample h - nRows is no longer intact
+		std::atomic_thread_fence(std::memory_order_release);
+		timeColumn[row].store(t, std::memory_order_relaxed);
+		timeColumn[row + nRows].store(t, std::memory_order_relaxed);
+		writeChannels(row, std::index_sequence_for<Channels...>(), values...);
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	/**
+	 * \return Max number of samples kept
+	 **/
+	size_t capacity() const { return cap; }
+
+	/**
+	 * \return Number of samples currently in the store
+	 **/
+	size_t size() const {
+		const uint64_t h = head.load(std::memory_order_acquire);
+		return (h < cap) ? (size_t)h : cap;
+	}
+
+	/**
+	 * \return Number of samples appended since the store was created
+	 **/
+	uint64_t total() const {
+		return head.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * The most recent samples, oldest first.
+	 * \param n Max number of samples
+	 * \return Slice with up to n samples
+	 **/
+	Slice latest(size_t n) const {
+		const uint64_t h = head.load(std::memory_order_acquire);
+		const uint64_t available = (h < cap) ? h : cap;
+		if (n > available) n = (size_t)available;
+		Slice s;
+		s.first = h - n;
+		const size_t row = s.first % nRows;
+		s.time = TimeSeriesSpan<Time>(timeColumn.get() + row, n);
+		s.channels = channelSpans(row, n, std::index_sequence_for<Channels...>());
+		return s;
+	}
+
+	/**
+	 * \return All samples in the store, oldest first
+	 **/
+	Slice all() const {
+		return latest(cap);
+	}
+
+	/**
+	 * Binary search for the samples newer than a timestamp.
+	 * \param t Timestamp
+	 * \return The samples with timestamps > t
+	 **/
+	Slice since(Time t) const {
+		return all().since(t);
+	}
+
+	/**
+	 * Checks after a slice has been consumed that the writer
+	 * hasn't overwritten any of it in the meantime.
+	 * \param slice A slice obtained from this store
+	 * \return true if the values read from the slice are valid
+	 **/
+	bool intact(const Slice& slice) const {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t h = head.load(std::memory_order_relaxed);
+		// sample i is intact as long as sample i + nRows hasn't been started
+		return (h < nRows) || (slice.first >= h - nRows + 1);
+	}
+
+private:
+	template<size_t... I>
+	void writeChannels(size_t row, std::index_sequence<I...>, const Channels&... values) {
+		const int dummy[] = { 0, (std::get<I>(columns)[row].store(values, std::memory_order_relaxed),
+					  std::get<I>(columns)[row + nRows].store(values, std::memory_order_relaxed), 0)... };
+		(void)dummy;
+	}
+
+	template<size_t... I>
+	std::tuple<TimeSeriesSpan<Channels>...> channelSpans(size_t row, size_t n,
+							     std::index_sequence<I...>) const {
+		return std::make_tuple(TimeSeriesSpan<Channels>(std::get<I>(columns).get() + row, n)...);
+	}
+
+	const size_t cap;
+	const size_t nRows;
+	std::unique_ptr<std::atomic<Time>[]> timeColumn;
+	std::tuple<std::unique_ptr<std::atomic<Channels>[]>...> columns;
+	// written by the writer and polled by all readers so it
+	// gets a cache line on its own
+	alignas(64) std::atomic<uint64_t> head{0};
+	char padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+#endif